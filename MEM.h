@@ -52,11 +52,12 @@ char *MEM_strdup_func(MEM_Controller controller,
                       char           *filename,
                       int            line,
                       char           *str);
+/* ストレージ(一括解放する領域)の生成. page_sizeはページのAlign数(0ならデフォルト) */
 MEM_Storage MEM_open_storage_func(MEM_Controller controller,
                                   char           *filename,
                                   int            line,
-                                  MEM_Storage    storage,
-                                  size_t         size);
+                                  int            page_size);
+/* ストレージからの領域確保 */
 void *MEM_storage_malloc_func(MEM_Controller controller,
                               char           *filename,
                               int            line,
@@ -65,6 +66,7 @@ void *MEM_storage_malloc_func(MEM_Controller controller,
 /* 領域解放 */
 void MEM_free_func(MEM_Controller controller,
                    void           *ptr);
+/* ストレージの一括解放 */
 void MEM_dispose_storage_func(MEM_Controller controller,
                               MEM_Storage    storage);
 /* エラーハンドラのセット */
@@ -101,12 +103,17 @@ void MEM_check_all_blocks_func(MEM_Controller controller,
 #define MEM_strdup(str)\
   (MEM_strdup_func(MEM_CURRENT_CONTROLLER,\
                    __FILE__, __LINE__, str))
+/* ストレージの生成 */
 #define MEM_open_storage(page_size)\
   (MEM_open_storage_func(MEM_CURRENT_CONTROLLER,\
                          __FILE__, __LINE__, page_size))
+/* ストレージからの領域確保 */
 #define MEM_storage_malloc(storage, size)\
   (MEM_storage_malloc_func(MEM_CURRENT_CONTROLLER,\
                            __FILE__, __LINE__, storage, size))
+/* ストレージの一括解放 */
+#define MEM_dispose_storage(storage)\
+  (MEM_dispose_storage_func(MEM_CURRENT_CONTROLLER, storage))
 /* 領域解放 */
 #define MEM_free(ptr)\
   (MEM_free_func(MEM_CURRENT_CONTROLLER, ptr))
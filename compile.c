@@ -1,12 +1,15 @@
 #include "compile.h"
 
 static Token token;               /* 次のトークン */
+static MEM_Storage compile_storage = NULL; /* コンパイル中だけ使う領域. コンパイル終了時に一括解放 */
 static int *increment_table_list; /* インクリメントする変数のテーブルインデックス・リスト */
 static int increment_table_count; /* インクリメントする変数のテーブルリストの長さ. 式の中にあるインクリメントの数と同一 */
 static int *decrement_table_list; /* デクリメントする変数のテーブルインデックス・リスト */
 static int decrement_table_count; /* デクリメントする変数のテーブルリストの長さ. 式の中にあるインクリメントの数と同一 */
-static int *break_labels[MAX_BLOCK_LEVEL];        /* 現ブロックのbreakのラベル */
-static int *continue_labels[MAX_BLOCK_LEVEL];     /* 現ブロックのcontinueのラベル */
+static int **break_labels    = NULL;  /* 各ブロックのbreakのラベル. ブロックレベルで引く */
+static int **continue_labels = NULL;  /* 各ブロックのcontinueのラベル */
+static int labels_alloc      = 0;     /* break_labels, continue_labelsの割り当てサイズ */
+static int switch_nest       = 0;     /* 最内のループ内で判定式を積んだままのswitch文の数 */
 
 /* コンパイル・モジュール群 */
 static void toplevel(void);               /* トップレベルのコンパイル */
@@ -39,19 +42,34 @@ static void addBreakLabel(int current_pc);        /* breakラベルの追加 */
 static void addContinueLabel(int current_pc);     /* continueラベルの追加 */
 static void backPatchBreakLabels(void);           /* breakラベルの一括バックパッチ */
 static void backPatchContinueLabels(int loop_pc); /* continueラベルの一括バックパッチ */
+static void checkLabelsSize(int block_level);     /* ラベル表をblock_levelまで引けるように拡張 */
+static int *extendList(int *list, int count);     /* count個目の要素が入るようにリストを拡張 */
 
 /* コンパイル */
 int compile(void)
 {
   int toplevel_need_memory_label;      /* トップレベルで必要なメモリ量の為のラベル */
   /* printf("Start compilation. \n"); */
+  compile_storage = MEM_open_storage(0);  /* コンパイル中だけ使う領域を開く */
+  setTableStorage(compile_storage);
   initSource();                        /* 字句解析の準備 */
   token = nextToken();                 /* 最初の先読みトークンを読む */
   blockBegin(FIRST_LOCAL_ADDRESS, TOPLEVEL);  /* スタック型記憶域の初期化も兼ねてブロックをセット */
-  toplevel_need_memory_label = genCodeMove(LVM_MOVE_STACK_P, 0);  /* 復帰情報の分を含めてトップを移動 */
+  toplevel_need_memory_label = genCodeEnter(0);  /* 復帰情報の分を含めてトップを移動 */
   toplevel();                          /* トップレベルからコンパイル */
   changeMoveTop(toplevel_need_memory_label, getBlockNeedMemory());                            /* トップレベルで必要なスタック容量 */
+  genCodeCalc(LVM_HALT);                      /* 命令列の終端 */
   blockEnd();                                 /* ブロックの終了 */
+  peepholeOptimize();                         /* 命令列をスーパー命令に融合 */
+  computeStackNeed();                         /* 各フレームの最大スタック必要量を確定 */
+
+  /* コンパイル中だけ使った領域を一括解放 */
+  setTableStorage(NULL);
+  MEM_dispose_storage(compile_storage);
+  compile_storage = NULL;
+  break_labels    = NULL;
+  continue_labels = NULL;
+  labels_alloc    = 0;
 
   return 0;   /* TODO: エラー個数を返すようにする */
 }
@@ -144,29 +162,23 @@ static void constDecl(void)
     /* 代入する値で場合分け */
     switch (token.kind) {
       case INT_LITERAL:       /* 整数リテラル */
-        value_temp.type        = LL1LL_INT_TYPE;
-        value_temp.u.int_value = token.u.int_value;
+        set_int_value(value_temp, token.u.int_value);
         token = nextToken();
         break;
       case DOUBLE_LITERAL:    /* 倍精度実数リテラル */
-        value_temp.type           = LL1LL_DOUBLE_TYPE;
-        value_temp.u.double_value = token.u.double_value;
+        set_double_value(value_temp, token.u.double_value);
         token = nextToken();
         break;
       case STRING_LITERAL:    /* 文字列リテラル */
-        value_temp.type           = LL1LL_OBJECT_TYPE;
-        value_temp.u.object->type = STRING_OBJECT;
-        value_temp.u.object       = alloc_string(token.u.string_value, LL1LL_FALSE);  /* リテラルではないためLL1LL_FALSE */
+        set_object(value_temp, alloc_string(token.u.string_value));
         token = nextToken();
         break;
       case TRUE_LITERAL:      /* 論理値リテラル */
-        value_temp.type            = LL1LL_BOOLEAN_TYPE;
-        value_temp.u.boolean_value = LL1LL_TRUE;
+        set_boolean_value(value_temp, LL1LL_TRUE);
         token = nextToken();
         break;
       case FALSE_LITERAL:
-        value_temp.type            = LL1LL_BOOLEAN_TYPE;
-        value_temp.u.boolean_value = LL1LL_FALSE;
+        set_boolean_value(value_temp, LL1LL_FALSE);
         token = nextToken();
         break;
       default:                /* それ以外はシンタックスエラー */
@@ -255,7 +267,9 @@ static void function_block(int function_index)
   int func_end_label;
   int func_local_vars_label;
   /* デフォルトの返り値(明示的にreturnしない時の返り値) */
-  LL1LL_Value default_return = {.type = LL1LL_INT_TYPE, .u.int_value = 0};
+  LL1LL_Value default_return;
+
+  set_int_value(default_return, 0);
 
   /* 関数定義の時は, 必ず本体は飛び越す */
   func_end_label = genCodeJump(LVM_JUMP, 0);
@@ -263,7 +277,7 @@ static void function_block(int function_index)
   /* 関数の飛び先アドレスを次の命令にセットし,
    * スタック必要量だけスタックトップを移動する */
   changeFuncAddr(function_index, nextCode());
-  func_local_vars_label = genCodeMove(LVM_MOVE_STACK_P, 0);
+  func_local_vars_label = genCodeEnter(getNumParams(function_index));
 
   while (1) {
     if (token.kind == RIGHT_BRACE
@@ -333,7 +347,6 @@ static void statement(void)
 {
 
   int tmp_label;          /* break, continue用の仮ラベル */
-  int plain_block_vars_label;   /* 普通のブロック内の変数個数のトップ移動の為のラベル */
 
   switch (token.kind) {
     case IF:
@@ -370,6 +383,10 @@ static void statement(void)
         fprintf(stderr, "Error! This block isn't loop block, so cannot use continue. \n");
         exit(1);
       }
+      /* 囲むswitch文の判定式を捨てて, ループ開始時の深さに戻す */
+      if (switch_nest > 0) {
+        genCodeMove(LVM_MOVE_STACK_P, -switch_nest);
+      }
       tmp_label = genCodeJump(LVM_JUMP, 0);
       addContinueLabel(tmp_label);
       token = nextToken();
@@ -388,6 +405,10 @@ static void statement(void)
         fprintf(stderr, "Error! This block isn't loop block, so cannot use break. \n");
         exit(1);
       }
+      /* 囲むswitch文の判定式を捨てて, ループ開始時の深さに戻す */
+      if (switch_nest > 0) {
+        genCodeMove(LVM_MOVE_STACK_P, -switch_nest);
+      }
       /* 命令の生成, 後にバックパッチする */
       tmp_label = genCodeJump(LVM_JUMP, 0);
       addBreakLabel(tmp_label);
@@ -410,7 +431,10 @@ static void statement(void)
       /* expression -> (;)の並び */
       token = nextToken();
       expression();         /* 返り値 */
-      genCodeReturn();      /* return命令の生成 */
+      /* 式が関数呼び出しなら末尾呼び出しにする. その時はreturn命令は不要 */
+      if (!genCodeTailInvoke()) {
+        genCodeReturn();    /* return命令の生成 */
+      }
       /* ';'は省略可能に */
       if (token.kind == SEMICOLON) {
         token = nextToken();
@@ -422,15 +446,9 @@ static void statement(void)
     case LEFT_BRACE_STRING:
       /* ブロックのコンパイルへ */
       token = nextToken();
+      /* ブロック内の変数は関数のフレームに割り当てられるので, トップは動かさない */
       blockBegin(0, NORMAL_BLOCK);
-      plain_block_vars_label = genCodeMove(LVM_MOVE_STACK_P, 0);
       block();
-      /* ここでスタック必要量が分かるのでバックパッチ的に更新 */
-      changeMoveTop(plain_block_vars_label, getBlockNeedMemory());
-      /* このブロックで宣言定義した変数を破壊し, スタックトップをを元の位置に戻す */
-      if (getBlockNeedMemory() > 0) {
-        genCodeMove(LVM_MOVE_STACK_P, -getBlockNeedMemory());
-      }
       blockEnd();
       break;
     default:
@@ -461,7 +479,7 @@ static void if_statement(void)
 
   /* 最初の条件が満たされない場合の飛び先の
    * ラベルを得る. bp_labelには現在のpcが入る */
-  if_false_label = genCodeJump(LVM_JUMP_IF_FALSE, 0);
+  if_false_label = genCodeCondJump(LVM_JUMP_IF_FALSE, 0);
 
   /* 処理内容のコンパイル */
   token = checkGetToken2(token, LEFT_BRACE, LEFT_BRACE_STRING);
@@ -474,7 +492,7 @@ static void if_statement(void)
   /* 中身を実行した -> if文の終わりに飛び越す
    * 終わりに飛び越すラベルの追加 */
   if_count++;
-  if_end_labels    = (int *)MEM_realloc(if_end_labels, sizeof(int) * if_count);
+  if_end_labels    = extendList(if_end_labels, if_count);
   if_end_labels[0] = genCodeJump(LVM_JUMP, 0);
 
 
@@ -490,7 +508,7 @@ static void if_statement(void)
 
     /* elsifの条件が満たされない場合の飛び先の
      * ラベルを得る. bp_labelには現在のpc */
-    if_false_label = genCodeJump(LVM_JUMP_IF_FALSE, 0);
+    if_false_label = genCodeCondJump(LVM_JUMP_IF_FALSE, 0);
 
     /* 処理内容のコンパイル */
     token = checkGetToken2(token, LEFT_BRACE, LEFT_BRACE_STRING);
@@ -502,7 +520,7 @@ static void if_statement(void)
 
     /* 中身を実行した -> if文の終わりに飛び越す */
     if_count++;
-    if_end_labels    = (int *)MEM_realloc(if_end_labels, sizeof(int) * if_count);
+    if_end_labels    = extendList(if_end_labels, if_count);
     if_end_labels[if_count-1] = genCodeJump(LVM_JUMP, 0);
 
     /* elsif条件が満たされない場合の飛び先にバックパッチ */
@@ -526,7 +544,6 @@ static void if_statement(void)
   for (if_i = 0; if_i < if_count; if_i++) {
     backPatch(if_end_labels[if_i]);
   }
-  MEM_free(if_end_labels);
 
 }
 
@@ -540,6 +557,7 @@ static void switch_statement(void)
   /* ( -> expression -> ) -> { の並びを確認 */
   token = checkGetToken(token, LEFT_PARLEN);
   expression();   /* 判定式のプッシュ */
+  switch_nest++;
   token = checkGetToken(token, RIGHT_PARLEN);
   token = checkGetToken2(token, LEFT_BRACE, LEFT_BRACE_STRING);
 
@@ -555,10 +573,10 @@ static void switch_statement(void)
     token = nextToken();
     expression();               /* 一つのケースを生成 */
 
-    genCodeCalc(LVM_EQUAL);     /* ケース判定 */
+    /* ケース判定. 等しければ処理内容に */
     one_case_count++;
-    true_labels    = (int *)MEM_realloc(true_labels, sizeof(int) * one_case_count);
-    true_labels[0] = genCodeJump(LVM_JUMP_IF_TRUE, 0);
+    true_labels    = extendList(true_labels, one_case_count);
+    true_labels[0] = genCodeJump(LVM_JEQ, 0);
 
     /* expression -> , の並び */
     while (token.kind == COMMA) {
@@ -567,10 +585,10 @@ static void switch_statement(void)
       /* expression();                一つのケースを生成 */
       term();
 
-      genCodeCalc(LVM_EQUAL);     /* ケース判定 */
+      /* ケース判定. 等しければ処理内容に */
       one_case_count++;
-      true_labels = (int *)MEM_realloc(true_labels, sizeof(int) * one_case_count);
-      true_labels[one_case_count-1] = genCodeJump(LVM_JUMP_IF_TRUE, 0);                         /* 真の場合は処理内容に */
+      true_labels = extendList(true_labels, one_case_count);
+      true_labels[one_case_count-1] = genCodeJump(LVM_JEQ, 0);
     }
     token = checkGetToken(token, COLON);
 
@@ -583,7 +601,6 @@ static void switch_statement(void)
          onecase_i++) {
       backPatch(true_labels[onecase_i]);
     }
-    MEM_free(true_labels);
 
     /* 処理内容の文リスト */
     while (token.kind != CASE
@@ -595,7 +612,7 @@ static void switch_statement(void)
 
     /* 処理を行った場合の終わりに飛び越す命令 */
     case_count++;
-    endcase_labels               = (int *)MEM_realloc(endcase_labels, sizeof(int) * case_count);
+    endcase_labels               = extendList(endcase_labels, case_count);
     endcase_labels[case_count-1] = genCodeJump(LVM_JUMP, 0);
 
     /* 次のケースへ飛び越すラベルにバックパッチ */
@@ -622,10 +639,10 @@ static void switch_statement(void)
        case_i++) {
     backPatch(endcase_labels[case_i]);
   }
-  MEM_free(endcase_labels);
 
   /* 評価式の値がスタックに残るので, 取り除く */
   genCodeCalc(LVM_POP);
+  switch_nest--;
 
 }
 
@@ -636,13 +653,12 @@ static void for_statement(void)
   int for_loop_label, for_end_label;
   /* 更新式の最初と最後に飛び越すラベル */
   int update_begin_label, update_end_label;
-  /* for文内のスタック必要量の為のラベル */
-  int for_block_need_memory_label;
-
+  /* 外側のswitch文の判定式は, このループのbreak/continueでは捨てない */
+  int outer_switch_nest = switch_nest;
 
   /* ブロックのスコープはここからスタート */
   blockBegin(0, LOOP_BLOCK);
-  for_block_need_memory_label = genCodeMove(LVM_MOVE_STACK_P, 0);
+  switch_nest = 0;
 
   /* ( を確認 */
   token = checkGetToken(token, LEFT_PARLEN);
@@ -666,7 +682,7 @@ static void for_statement(void)
   token = checkGetToken(token, SEMICOLON);
 
   /* 偽ならば終わりに飛び越す */
-  for_end_label  = genCodeJump(LVM_JUMP_IF_FALSE, 0);
+  for_end_label  = genCodeCondJump(LVM_JUMP_IF_FALSE, 0);
 
   /* 更新式は処理の後なので, 飛ばす */
   update_end_label = genCodeJump(LVM_JUMP, 0);
@@ -700,25 +716,17 @@ static void for_statement(void)
   /* break文のバックパッチ : blockを考慮 */
   if (getBreakCount() > 0) {
     backPatchBreakLabels();
-    MEM_free(break_labels[getBlockLevel()]);
     break_labels[getBlockLevel()] = NULL;
   } 
   /* continue文のバックパッチ : blockを考慮 */
   if (getContinueCount() > 0) {
     backPatchContinueLabels(for_loop_label);
-    MEM_free(continue_labels[getBlockLevel()]);
     continue_labels[getBlockLevel()] = NULL;
   }
 
-  /* スタック必要量を確定させる */
-  changeMoveTop(for_block_need_memory_label, getBlockNeedMemory());
-  /* このブロックで宣言定義した変数を破壊し, スタックトップをを元の位置に戻す */
-  if (getBlockNeedMemory() > 0) {
-    genCodeMove(LVM_MOVE_STACK_P, -getBlockNeedMemory());
-  }
-
   /* ここでブロックを閉じる(break, continueのバックパッチのため) */
   blockEnd();
+  switch_nest = outer_switch_nest;
 
 }
 
@@ -727,11 +735,9 @@ static void while_statement(void)
 {
   /* ループと終わりのラベル */
   int while_loop_label, while_end_label;
-  /* while文で必要なスタックのラベル */
-  int while_block_need_memory_label;  
+  /* 外側のswitch文の判定式は, このループのbreak/continueでは捨てない */
+  int outer_switch_nest = switch_nest;
 
-  /* スタック必要量だけトップを動かす */
-  while_block_need_memory_label = genCodeMove(LVM_MOVE_STACK_P, 0);
   /* ループ先のラベルにセット */
   while_loop_label = nextCode();
   /* ( -> expression -> ) -> block の順にコンパイル */
@@ -739,11 +745,12 @@ static void while_statement(void)
   expression();
   token = checkGetToken(token, RIGHT_PARLEN);
   /* while文の終わりに飛び越す命令 */
-  while_end_label = genCodeJump(LVM_JUMP_IF_FALSE, 0);
+  while_end_label = genCodeCondJump(LVM_JUMP_IF_FALSE, 0);
 
   /* 処理内容のコンパイル */
   token = checkGetToken2(token, LEFT_BRACE, LEFT_BRACE_STRING);
   blockBegin(0, LOOP_BLOCK);
+  switch_nest = 0;
 
   block();
 
@@ -756,25 +763,17 @@ static void while_statement(void)
   /* break文のバックパッチ */
   if (getBreakCount() > 0) {
     backPatchBreakLabels();
-    MEM_free(break_labels[getBlockLevel()]);
     break_labels[getBlockLevel()] = NULL;
   } 
   /* continue文のバックパッチ */
   if (getContinueCount() > 0) {
     backPatchContinueLabels(while_loop_label);
-    MEM_free(continue_labels[getBlockLevel()]);
     continue_labels[getBlockLevel()] = NULL;
   }
 
-  /* while文で必要なスタック容量を確定 */
-  changeMoveTop(while_block_need_memory_label, getBlockNeedMemory());
-  /* このブロックで宣言定義した変数を破壊し, スタックトップをを元の位置に戻す */
-  if (getBlockNeedMemory() > 0) {
-    genCodeMove(LVM_MOVE_STACK_P, -getBlockNeedMemory());
-  }
-
   /* ブロックを閉じる */
   blockEnd();
+  switch_nest = outer_switch_nest;
 
 }
 
@@ -782,7 +781,8 @@ static void while_statement(void)
 static void do_while_statement(void)
 {
   int do_while_loop_label;
-  int do_while_block_need_memory_label;
+  /* 外側のswitch文の判定式は, このループのbreak/continueでは捨てない */
+  int outer_switch_nest = switch_nest;
   /* block -> while -> ( -> expression -> ) 
    * の順にコンパイル */
 
@@ -790,7 +790,7 @@ static void do_while_statement(void)
   /* 処理内容のコンパイル */
   token = checkGetToken2(token, LEFT_BRACE, LEFT_BRACE_STRING);
   blockBegin(0, LOOP_BLOCK);
-  do_while_block_need_memory_label = genCodeMove(LVM_MOVE_STACK_P, 0);
+  switch_nest = 0;
 
   /* ループの先頭のラベルをセット */
   do_while_loop_label = nextCode();
@@ -803,30 +803,22 @@ static void do_while_statement(void)
   token = checkGetToken(token, RIGHT_PARLEN);
 
   /* ループの先頭に飛び越す命令へバックパッチ */
-  genCodeJump(LVM_JUMP_IF_TRUE, do_while_loop_label);
+  genCodeCondJump(LVM_JUMP_IF_TRUE, do_while_loop_label);
 
   /* break文のバックパッチ */
   if (getBreakCount() > 0) {
     backPatchBreakLabels();
-    MEM_free(break_labels[getBlockLevel()]);
     break_labels[getBlockLevel()] = NULL;
   } 
   /* continue文のバックパッチ */
   if (getContinueCount() > 0) {
     backPatchContinueLabels(do_while_loop_label);
-    MEM_free(continue_labels[getBlockLevel()]);
     continue_labels[getBlockLevel()] = NULL;
   }
 
-  /* この文で必要なスタック容量 */
-  changeMoveTop(do_while_block_need_memory_label, getBlockNeedMemory());
-  /* このブロックで宣言/定義した変数を破壊し, スタックトップをを元の位置に戻す */
-  if (getBlockNeedMemory() > 0) {
-    genCodeMove(LVM_MOVE_STACK_P, -getBlockNeedMemory());
-  }
-
   /* ブロックを閉じる */
   blockEnd();
+  switch_nest = outer_switch_nest;
 
 }
 
@@ -977,8 +969,6 @@ static void expression(void)
       genCodeCalc(LVM_INCREMENT);
       genCodeTable(LVM_POP_VARIABLE, increment_table_list[inc_dec_i]);
     }
-    /* リストの解放 */
-    MEM_free(increment_table_list);
   }
 
   /* デクリメントの実行 */
@@ -991,8 +981,6 @@ static void expression(void)
       genCodeCalc(LVM_DECREMENT);
       genCodeTable(LVM_POP_VARIABLE, decrement_table_list[inc_dec_i]);
     }
-    /* リストの解放 */
-    MEM_free(decrement_table_list);
   }
 
 }
@@ -1093,13 +1081,32 @@ static void compare_expression(void)
 
 }
 
-/* 加算式のコンパイル */
+/* 加算式のコンパイル.
+ * 文字列リテラルから始まる+の連鎖("a" + x + "b" + ...)は, 途中の結果を作らないように
+ * 全ての値を積んでから一つの連結命令(LVM_CONCAT_N)でまとめて連結する */
 static void add_expression(void)
 {
   /* 演算子の種類 */
   Token_kind op_kind;
+  int first_pc = nextCode();  /* 最初の積算式の先頭pc */
+  int concat_count = 0;       /* 連結の連鎖で積んだ値の数. 連鎖でなければ0 */
   /* まず, 積算式を読む */
   mul_expression();
+  /* 文字列の即値一つだけなら, 連結の連鎖の始まり */
+  if (nextCode() == first_pc + 1 && isStringImmediate(first_pc)) {
+    concat_count = 1;
+  }
+  /* 連鎖の+ -> 積算式を積んでいく */
+  while (concat_count > 0 && token.kind == PLUS) {
+    token = nextToken();
+    mul_expression();
+    concat_count++;
+  }
+  if (concat_count > 2) {
+    genCodeConcat(concat_count);
+  } else if (concat_count == 2) {
+    genCodeCalc(LVM_ADD);
+  }
   /* +,- -> 積算式の並び */
   while (token.kind == PLUS || token.kind == MINUS) {
     op_kind = token.kind;
@@ -1245,13 +1252,13 @@ static void term(void)
             case INCREMENT:
               token = nextToken();
               increment_table_count++;
-              increment_table_list = (int *)MEM_realloc(increment_table_list, sizeof(int) * increment_table_count);
+              increment_table_list = extendList(increment_table_list, increment_table_count);
               increment_table_list[increment_table_count-1] = table_index; /* 今見つけたテーブルインデックス */
               break;
             case DECREMENT:
               token = nextToken();
               decrement_table_count++;
-              decrement_table_list = (int *)MEM_realloc(decrement_table_list, sizeof(int) * decrement_table_count);
+              decrement_table_list = extendList(decrement_table_list, decrement_table_count);
               decrement_table_list[decrement_table_count-1] = table_index; /* 今見つけたテーブルインデックス */
               break;
             default:  /* 何もしない */
@@ -1308,32 +1315,27 @@ static void term(void)
       break;
       /* リテラル : その場でコード生成 */
     case INT_LITERAL:
-      temp_value.type        = LL1LL_INT_TYPE;
-      temp_value.u.int_value = token.u.int_value;
+      set_int_value(temp_value, token.u.int_value);
       genCodeValue(LVM_PUSH_IMMEDIATE, temp_value);
       token = nextToken();
       break;
     case DOUBLE_LITERAL:
-      temp_value.type           = LL1LL_DOUBLE_TYPE;
-      temp_value.u.double_value = token.u.double_value;
+      set_double_value(temp_value, token.u.double_value);
       genCodeValue(LVM_PUSH_IMMEDIATE, temp_value);
       token = nextToken();
       break;
     case STRING_LITERAL:
-      temp_value.type     = LL1LL_OBJECT_TYPE;
-      temp_value.u.object = alloc_string(token.u.string_value, LL1LL_TRUE);
+      set_object(temp_value, alloc_string(token.u.string_value));
       genCodeValue(LVM_PUSH_IMMEDIATE, temp_value);
       token = nextToken();
       break;
     case TRUE_LITERAL:
-      temp_value.type            = LL1LL_BOOLEAN_TYPE;
-      temp_value.u.boolean_value = LL1LL_TRUE;
+      set_boolean_value(temp_value, LL1LL_TRUE);
       genCodeValue(LVM_PUSH_IMMEDIATE, temp_value);
       token = nextToken();
       break;
     case FALSE_LITERAL:
-      temp_value.type            = LL1LL_BOOLEAN_TYPE;
-      temp_value.u.boolean_value = LL1LL_FALSE;
+      set_boolean_value(temp_value, LL1LL_FALSE);
       genCodeValue(LVM_PUSH_IMMEDIATE, temp_value);
       token = nextToken();
       break;
@@ -1345,20 +1347,17 @@ static void term(void)
       break;
       /* ストリームのリテラル */
     case STDIN:
-      temp_value.type           = LL1LL_STREAM_TYPE;
-      temp_value.u.stream_value = stdin;
+      set_stream_value(temp_value, stdin);
       genCodeValue(LVM_PUSH_IMMEDIATE, temp_value);
       token = nextToken();
       break;
     case STDOUT:
-      temp_value.type           = LL1LL_STREAM_TYPE;
-      temp_value.u.stream_value = stdout;
+      set_stream_value(temp_value, stdout);
       genCodeValue(LVM_PUSH_IMMEDIATE, temp_value);
       token = nextToken();
       break;
     case STDERR:
-      temp_value.type           = LL1LL_STREAM_TYPE;
-      temp_value.u.stream_value = stderr;
+      set_stream_value(temp_value, stderr);
       genCodeValue(LVM_PUSH_IMMEDIATE, temp_value);
       token = nextToken();
       break;
@@ -1382,7 +1381,8 @@ static void addBreakLabel(int current_pc)
   int block_level = getBlockLevel();
   /* 個数と領域を増やし, pcを登録 */
   int count = incBreakCount();
-  break_labels[block_level] = (int *)MEM_realloc(break_labels[block_level], sizeof(int) * count);
+  checkLabelsSize(block_level);
+  break_labels[block_level] = extendList(break_labels[block_level], count);
   break_labels[block_level][count-1] = current_pc;
 }
 
@@ -1393,7 +1393,8 @@ static void addContinueLabel(int current_pc)
   int block_level = getBlockLevel();
   /* 個数と領域を増やし, pcを登録 */
   int count = incContinueCount();
-  continue_labels[block_level] = (int *)MEM_realloc(continue_labels[block_level], sizeof(int) * count);
+  checkLabelsSize(block_level);
+  continue_labels[block_level] = extendList(continue_labels[block_level], count);
   continue_labels[block_level][count-1] = current_pc;
 }
 
@@ -1420,3 +1421,52 @@ static void backPatchContinueLabels(int loop_pc)
     changeJumpPc(continue_labels[getBlockLevel()][i], loop_pc);
   }
 }
+
+/* ラベル表をblock_levelまで引けるように, 倍々で拡張する.
+ * 新しい要素はNULL(ラベル無し)にしておく */
+static void checkLabelsSize(int block_level)
+{
+  int i, new_alloc;
+  int **new_break_labels, **new_continue_labels;
+
+  if (block_level < labels_alloc) {
+    return;
+  }
+  new_alloc = (labels_alloc == 0) ? 16 : labels_alloc;
+  while (new_alloc <= block_level) {
+    new_alloc *= 2;
+  }
+  new_break_labels    = (int **)MEM_storage_malloc(compile_storage, sizeof(int *) * new_alloc);
+  new_continue_labels = (int **)MEM_storage_malloc(compile_storage, sizeof(int *) * new_alloc);
+  for (i = 0; i < labels_alloc; i++) {
+    new_break_labels[i]    = break_labels[i];
+    new_continue_labels[i] = continue_labels[i];
+  }
+  break_labels    = new_break_labels;
+  continue_labels = new_continue_labels;
+  for (i = labels_alloc; i < new_alloc; i++) {
+    break_labels[i]    = NULL;
+    continue_labels[i] = NULL;
+  }
+  labels_alloc = new_alloc;
+}
+
+/* ラベル等のリストにcount個目の要素を入れられるようにする.
+ * 領域はコンパイル中の記憶域から取るので解放はしない.
+ * 要素数が4, 8, 16, ...を越える時だけ倍の領域に移し替える */
+static int *extendList(int *list, int count)
+{
+  int old_count = count - 1;
+  int *new_list;
+
+  if (count > 1
+      && (old_count < 4 || (old_count & (old_count - 1)) != 0)) {
+    return list;
+  }
+  new_list = (int *)MEM_storage_malloc(compile_storage,
+                                       sizeof(int) * ((count == 1) ? 4 : old_count * 2));
+  if (old_count > 0) {
+    memcpy(new_list, list, sizeof(int) * old_count);
+  }
+  return new_list;
+}
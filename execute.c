@@ -1,7 +1,11 @@
 #include "execute.h"
 
-static LL1LL_Value stack[MAX_EXE_STACK_SIZE]; /* 実行時スタック */
+static LL1LL_Value *stack = NULL;             /* 実行時スタック */
+static int stack_size = 0;                    /* 実行時スタックの割り当てサイズ */
 static int top;                               /* スタックトップ(プッシュ・ポップの対象となるスタックのインデックス). 次に更新されるスタックのアドレス. */
+static int display[MAX_BLOCK_LEVEL];          /* ディスプレイ:各レベルの関数(トップレベル)の, 実行中のフレームの先頭アドレス */
+static char *concat_buf = NULL;               /* 文字列連結の連鎖で, 数値を文字列にしたものを並べておくバッファ */
+static int concat_buf_size = 0;               /* concat_bufの割り当てサイズ */
 
 /* 単項演算命令のサブルーチン */
 static LL1LL_Value do_single_calc(LL1LL_Value term,
@@ -10,6 +14,20 @@ static LL1LL_Value do_single_calc(LL1LL_Value term,
 static LL1LL_Value do_calculate(LL1LL_Value left, 
                                 LL1LL_Value right,
                                 LVM_OpCode);
+/* 文字列連結の連鎖のサブルーチン */
+static LL1LL_Value do_concat(LL1LL_Value *values,
+                             int count);
+/* 数値を文字列にしてbufに書き込む */
+static int formatNumber(LL1LL_Value value,
+                        char *buf,
+                        int size);
+/* 符号無し整数を10進の文字列にしてbufに書き込む */
+static int formatDigits(uint64_t value,
+                        char *buf);
+/* 実数を"%f"の書式でbufに書き込む */
+static int formatDouble(double value,
+                        char *buf,
+                        int size);
 /* 比較命令のサブルーチン */
 static LL1LL_Value do_compare(LL1LL_Value left, 
                               LL1LL_Value right,
@@ -17,9 +35,86 @@ static LL1LL_Value do_compare(LL1LL_Value left,
 /* ストリームプッシュのサブルーチン */
 static LL1LL_Value do_put_stream(LL1LL_Value left,
                                  LL1LL_Value right);
+/* 汎用の演算/比較命令を, オペランドの型に特化した命令に変換する */
+static LVM_OpCode quicken(LVM_OpCode generic,
+                          LL1LL_Value left,
+                          LL1LL_Value right);
+/* スタックをneed語以上に拡張する */
+static void growStack(int need);
+/* 比較分岐命令で, left, rightを比較した時にジャンプするか */
+static int compare_jump(LVM_OpCode opcode,
+                        LL1LL_Value left,
+                        LL1LL_Value right);
 /* スタックのstack_pの要素を印字 */
 static void printStackElement(int stack_p);
 
+/* 命令ディスパッチのマクロ.
+ * LVM_THREADED_CODEの時は, 処理ラベルのアドレスに変換した命令列から直接次の処理に飛ぶ.
+ * それ以外の時は, 従来通りswitch文で命令分岐する */
+#ifdef LVM_THREADED_CODE
+#define LVM_CASE(opcode)  L_##opcode
+#define LVM_DISPATCH() \
+  do { inst = &code[pc]; goto *threaded[pc++]; } while (0)
+#else /* LVM_THREADED_CODE */
+#define LVM_CASE(opcode)  case opcode
+#define LVM_DISPATCH()    continue
+#endif /* LVM_THREADED_CODE */
+
+/* at番目の命令のオペコードをnew_opcodeに書き換える(クイックニング).
+ * スレッデッドコードの時は, 処理ラベルの列も合わせて書き換える */
+#ifdef LVM_THREADED_CODE
+#define LVM_REWRITE(at, new_opcode) \
+  do { \
+    code[at].opcode = (new_opcode); \
+    threaded[at]    = label_table[code[at].opcode]; \
+  } while (0)
+#else /* LVM_THREADED_CODE */
+#define LVM_REWRITE(at, new_opcode) \
+  do { code[at].opcode = (new_opcode); } while (0)
+#endif /* LVM_THREADED_CODE */
+
+/* 型特化命令の処理本体.
+ * 一つ下とトップの型がleft_type, right_typeならばstatementを実行して次の命令へ.
+ * 型が合わなければ汎用命令generic_opcodeに書き戻し, 汎用の処理(generic_label)に回す */
+#define LVM_QUICKENED(left_type, right_type, statement, generic_opcode, generic_label) \
+  if (get_type(stack[top-2]) == (left_type) \
+      && get_type(stack[top-1]) == (right_type)) { \
+    top--; \
+    statement; \
+    LVM_DISPATCH(); \
+  } \
+  LVM_REWRITE(pc-1, generic_opcode); \
+  goto generic_label
+
+/* 現在の命令のジャンプ先へジャンプ.
+ * 後方ジャンプ(ループ)はGCの安全点とする */
+#define LVM_JUMP_TO_TARGET() \
+  do { \
+    pc = inst->u.jump_pc; \
+    if (&code[pc] <= inst) { \
+      gcSafePoint(); \
+    } \
+  } while (0)
+
+/* 比較分岐命令の処理本体.
+ * left, rightを比較分岐命令jump_opcode(即値/変数版は元の命令)で比較し, 成り立てばジャンプ.
+ * extra_wordsは追加オペランドの語数 */
+#define LVM_COMPARE_JUMP(jump_opcode, left, right, extra_words) \
+  if (compare_jump((jump_opcode), (left), (right))) { \
+    LVM_JUMP_TO_TARGET(); \
+  } else { \
+    pc += (extra_words); \
+  } \
+  LVM_DISPATCH()
+
+/* アドレスaddrの変数. 中間レベルの変数はディスプレイから辿る */
+#define LVM_VARIABLE(addr) \
+  stack[display[(addr).block_level] + (addr).address]
+
+/* 比較結果condを論理値として一つ下(結果の格納先)にセット */
+#define LVM_SET_COMPARE_RESULT(cond) \
+  set_boolean_value(stack[top-1], (cond) ? LL1LL_TRUE : LL1LL_FALSE)
+
 /* スタックトップを得る */
 int getStackTop(void)
 {
@@ -36,142 +131,511 @@ LL1LL_Value *getStackPointer(void)
 void execute(void)
 {
   int pc;                                     /* プログラムカウンタ */
+  int base;                                   /* 現在のフレームの先頭アドレス(現在の関数のディスプレイ) */
   int temp_level;                             /* ブロックレベルと */
+  int new_base;                               /* 末尾呼び出しの呼び先のフレーム先頭 */
+  int slot;                                   /* 初期化するローカル変数のアドレス */
+  int num_args;                               /* 末尾呼び出しの実引数の数 */
+  LL1LL_Value link[FIRST_LOCAL_ADDRESS];      /* 末尾呼び出しで引き継ぐ復帰情報 */
   LL1LL_Value temp_value;                     /* 値のテンポラリ */
   LVM_Instruction *code = getInstruction();   /* 命令列 */
-  int code_size         = getCodeSize();      /* 命令列のサイズ */
-  LVM_Instruction inst;                       /* 現在の命令 */
-  /* int display[MAX_BLOCK_LEVEL] = {0};      ディスプレイの配列:各ブロックの先頭アドレス => tableに移動 */
+  LL1LL_Value *constants = getConstantPool(); /* 定数表(即値の実体) */
+  int code_size         = getCodeSize();      /* 命令列のサイズ(最後の命令はLVM_HALT) */
+  LVM_Instruction *inst;                      /* 現在の命令 */
+  LVM_OpCode temp_opcode;                     /* 書き換え前のオペコード */
+  LL1LL_Value *var_p;                         /* スーパー命令が操作する変数 */
+#ifdef LVM_THREADED_CODE
+  /* オペコードと処理ラベルの対応表. 並びは列挙型の値に合わせる */
+  static void *label_table[] = {
+    [LVM_NOP]              = &&L_LVM_NOP,
+    [LVM_MOVE_STACK_P]     = &&L_LVM_MOVE_STACK_P,
+    [LVM_PUSH_IMMEDIATE]   = &&L_LVM_PUSH_IMMEDIATE,
+    [LVM_PUSH_VALUE]       = &&L_LVM_PUSH_VALUE,
+    [LVM_POP_VARIABLE]     = &&L_LVM_POP_VARIABLE,
+    [LVM_POP]              = &&L_LVM_POP,
+    [LVM_DUPLICATE]        = &&L_LVM_DUPLICATE,
+    [LVM_PUSH_LOCAL]       = &&L_LVM_PUSH_LOCAL,
+    [LVM_POP_LOCAL]        = &&L_LVM_POP_LOCAL,
+    [LVM_PUSH_GLOBAL]      = &&L_LVM_PUSH_GLOBAL,
+    [LVM_POP_GLOBAL]       = &&L_LVM_POP_GLOBAL,
+    [LVM_JUMP]             = &&L_LVM_JUMP,
+    [LVM_JUMP_IF_TRUE]     = &&L_LVM_JUMP_IF_TRUE,
+    [LVM_JUMP_IF_FALSE]    = &&L_LVM_JUMP_IF_FALSE,
+    [LVM_INVOKE]           = &&L_LVM_INVOKE,
+    [LVM_RETURN]           = &&L_LVM_RETURN,
+    [LVM_ENTER]            = &&L_LVM_ENTER,
+    [LVM_TAIL_INVOKE]      = &&L_LVM_TAIL_INVOKE,
+    [LVM_MINUS]            = &&L_LVM_MINUS,
+    [LVM_LOGICAL_NOT]      = &&L_LVM_LOGICAL_NOT,
+    [LVM_INCREMENT]        = &&L_LVM_INCREMENT,
+    [LVM_DECREMENT]        = &&L_LVM_DECREMENT,
+    [LVM_ADD]              = &&L_LVM_ADD,
+    [LVM_SUB]              = &&L_LVM_SUB,
+    [LVM_MUL]              = &&L_LVM_MUL,
+    [LVM_DIV]              = &&L_LVM_DIV,
+    [LVM_MOD]              = &&L_LVM_MOD,
+    [LVM_POW]              = &&L_LVM_POW,
+    [LVM_CONCAT_N]         = &&L_LVM_CONCAT_N,
+    [LVM_LOGICAL_AND]      = &&L_LVM_LOGICAL_AND,
+    [LVM_LOGICAL_OR]       = &&L_LVM_LOGICAL_OR,
+    [LVM_EQUAL]            = &&L_LVM_EQUAL,
+    [LVM_NOT_EQUAL]        = &&L_LVM_NOT_EQUAL,
+    [LVM_GREATER]          = &&L_LVM_GREATER,
+    [LVM_GREATER_EQUAL]    = &&L_LVM_GREATER_EQUAL,
+    [LVM_LESSTHAN]         = &&L_LVM_LESSTHAN,
+    [LVM_LESSTHAN_EQUAL]   = &&L_LVM_LESSTHAN_EQUAL,
+    [LVM_POP_TO_STREAM]    = &&L_LVM_POP_TO_STREAM,
+    [LVM_PUSH_FROM_STREAM] = &&L_LVM_PUSH_FROM_STREAM,
+    [LVM_HALT]             = &&L_LVM_HALT,
+    [LVM_ADD_INT_INT]      = &&L_LVM_ADD_INT_INT,
+    [LVM_ADD_DBL_DBL]      = &&L_LVM_ADD_DBL_DBL,
+    [LVM_SUB_INT_INT]      = &&L_LVM_SUB_INT_INT,
+    [LVM_SUB_DBL_DBL]      = &&L_LVM_SUB_DBL_DBL,
+    [LVM_MUL_INT_INT]      = &&L_LVM_MUL_INT_INT,
+    [LVM_MUL_DBL_DBL]      = &&L_LVM_MUL_DBL_DBL,
+    [LVM_CONCAT_STR_STR]   = &&L_LVM_CONCAT_STR_STR,
+    [LVM_EQ_INT_INT]       = &&L_LVM_EQ_INT_INT,
+    [LVM_NE_INT_INT]       = &&L_LVM_NE_INT_INT,
+    [LVM_GT_INT_INT]       = &&L_LVM_GT_INT_INT,
+    [LVM_GE_INT_INT]       = &&L_LVM_GE_INT_INT,
+    [LVM_LT_INT_INT]       = &&L_LVM_LT_INT_INT,
+    [LVM_LE_INT_INT]       = &&L_LVM_LE_INT_INT,
+    [LVM_GT_DBL_DBL]       = &&L_LVM_GT_DBL_DBL,
+    [LVM_GE_DBL_DBL]       = &&L_LVM_GE_DBL_DBL,
+    [LVM_LT_DBL_DBL]       = &&L_LVM_LT_DBL_DBL,
+    [LVM_LE_DBL_DBL]       = &&L_LVM_LE_DBL_DBL,
+    [LVM_OPERAND]          = &&L_LVM_OPERAND,
+    [LVM_ADD_LOCAL_IMM]    = &&L_LVM_ADD_LOCAL_IMM,
+    [LVM_SUB_LOCAL_IMM]    = &&L_LVM_SUB_LOCAL_IMM,
+    [LVM_INC_LOCAL]        = &&L_LVM_INC_LOCAL,
+    [LVM_DEC_LOCAL]        = &&L_LVM_DEC_LOCAL,
+    [LVM_JLT]              = &&L_LVM_JLT,
+    [LVM_JLE]              = &&L_LVM_JLE,
+    [LVM_JGT]              = &&L_LVM_JGT,
+    [LVM_JGE]              = &&L_LVM_JGE,
+    [LVM_JEQ]              = &&L_LVM_JEQ,
+    [LVM_JNE]              = &&L_LVM_JNE,
+    [LVM_JLT_IMM]          = &&L_LVM_JLT_IMM,
+    [LVM_JLE_IMM]          = &&L_LVM_JLE_IMM,
+    [LVM_JGT_IMM]          = &&L_LVM_JGT_IMM,
+    [LVM_JGE_IMM]          = &&L_LVM_JGE_IMM,
+    [LVM_JEQ_IMM]          = &&L_LVM_JEQ_IMM,
+    [LVM_JNE_IMM]          = &&L_LVM_JNE_IMM,
+    [LVM_JLT_LOCAL]        = &&L_LVM_JLT_LOCAL,
+    [LVM_JLE_LOCAL]        = &&L_LVM_JLE_LOCAL,
+    [LVM_JGT_LOCAL]        = &&L_LVM_JGT_LOCAL,
+    [LVM_JGE_LOCAL]        = &&L_LVM_JGE_LOCAL,
+    [LVM_JEQ_LOCAL]        = &&L_LVM_JEQ_LOCAL,
+    [LVM_JNE_LOCAL]        = &&L_LVM_JNE_LOCAL,
+  };
+  void **threaded;                            /* 命令列を処理ラベルのアドレスに変換したもの(スレッデッドコード) */
+#endif /* LVM_THREADED_CODE */
 
   /* ---実行開始--- */
+  /* スタックの確保. トップレベルのフレームの必要量(入口命令の追加オペランド)も確認 */
+  growStack(INIT_EXE_STACK_SIZE);
+  growStack(code[1].u.move_top);
   top = 0; pc = 0;               /* スタックトップ, pcの初期化 */
   /* レベル0(トップレベル)の... */
-  stack[top].u.int_value   = 0;  /* ディスプレイの退避場所 */
-  stack[top+1].u.int_value = 0;  /* 戻り番地(終了番地) */
-  /* display[0]               = 0;   トップレベルの先頭番地:0 */
-  setDisplayAt(0,0);             /* トップレベルの先頭番地:0 */
-  
+  set_int_value(stack[top], 0);  /* ディスプレイの退避場所 */
+  set_int_value(stack[top+1], code_size);  /* 戻り番地(終了番地:LVM_HALT) */
+  set_int_value(stack[top+2], 0);          /* 呼び出し側のフレーム先頭 */
+  display[0] = 0;                /* トップレベルの先頭番地:0 */
+  base       = 0;
+
+#ifdef LVM_THREADED_CODE
+  /* 実行前に, 命令列を処理ラベルのアドレスの列に変換しておく */
+  threaded = (void **)MEM_malloc(sizeof(void *) * (code_size + 1));
+  for (pc = 0; pc <= code_size; pc++) {
+    if (code[pc].opcode >= sizeof(label_table) / sizeof(label_table[0])
+        || label_table[code[pc].opcode] == NULL) {
+      fprintf(stderr, "Error! Invailed opecode \n");
+      exit(EXIT_FAILURE);
+    }
+    threaded[pc] = label_table[code[pc].opcode];
+  }
+  pc = 0;
+#endif /* LVM_THREADED_CODE */
+
   /* ---命令実行--- */
-  do {
-    inst = code[pc++];  /* これから実行する命令語を取得 */
+#ifdef LVM_THREADED_CODE
+  LVM_DISPATCH();
+#else /* LVM_THREADED_CODE */
+  while (1) {
+    inst = &code[pc++];  /* これから実行する命令語を取得 */
     /* 命令分岐 */
-    switch (inst.opcode) {
-      case LVM_NOP:
+    switch (inst->opcode) {
+#endif /* LVM_THREADED_CODE */
+      LVM_CASE(LVM_NOP):
         /* 何もしない */
-        break;
-      case LVM_MOVE_STACK_P:
+        LVM_DISPATCH();
+      LVM_CASE(LVM_MOVE_STACK_P):
         /* スタックポインタの移動 */
-        top += inst.u.move_top;
-        /* TODO:スタックオーバーフローのチェック */
-        break;
-      case LVM_PUSH_IMMEDIATE:
+        top += inst->u.move_top;
+        LVM_DISPATCH();
+      LVM_CASE(LVM_PUSH_IMMEDIATE):
         /* 即値のプッシュ */
-        stack[top++] = inst.u.value;
-        break;
-      case LVM_PUSH_VALUE:
+        stack[top++] = constants[inst->u.const_index];
+        LVM_DISPATCH();
+      LVM_CASE(LVM_PUSH_VALUE):
         /* 変数のプッシュ : スタック記憶域からアドレスを取得してプッシュ */
-        stack[top++] 
-          = stack[getDisplayAt(inst.u.address.block_level)
-                    + inst.u.address.address];
-        break;
-      case LVM_POP_VARIABLE:
+        stack[top++] = LVM_VARIABLE(inst->u.address);
+        LVM_DISPATCH();
+      LVM_CASE(LVM_POP_VARIABLE):
         /* 変数のポップ : アドレスを指定してポップ */
-        stack[getDisplayAt(inst.u.address.block_level)
-                    + inst.u.address.address] = stack[--top];
-        break;
-      case LVM_POP:
+        LVM_VARIABLE(inst->u.address) = stack[--top];
+        LVM_DISPATCH();
+      LVM_CASE(LVM_PUSH_LOCAL):
+        /* 現在のフレームの変数のプッシュ */
+        stack[top++] = stack[base + inst->u.address.address];
+        LVM_DISPATCH();
+      LVM_CASE(LVM_POP_LOCAL):
+        /* 現在のフレームの変数へのポップ */
+        stack[base + inst->u.address.address] = stack[--top];
+        LVM_DISPATCH();
+      LVM_CASE(LVM_PUSH_GLOBAL):
+        /* トップレベルの変数のプッシュ. トップレベルのフレームはスタックの先頭 */
+        stack[top++] = stack[inst->u.address.address];
+        LVM_DISPATCH();
+      LVM_CASE(LVM_POP_GLOBAL):
+        /* トップレベルの変数へのポップ */
+        stack[inst->u.address.address] = stack[--top];
+        LVM_DISPATCH();
+      LVM_CASE(LVM_POP):
         /* 単純にトップを一つずらすだけ */
         top--;
-        break;
-      case LVM_DUPLICATE:
+        LVM_DISPATCH();
+      LVM_CASE(LVM_DUPLICATE):
         /* トップの値を複製してプッシュ */
         stack[top] = stack[top-1];
         top++;
-        break;
-      case LVM_JUMP:
+        LVM_DISPATCH();
+      LVM_CASE(LVM_JUMP):
         /* 無条件ジャンプ */
-        pc = inst.u.jump_pc;  /* pcを書き換える */
-        break;
-      case LVM_JUMP_IF_TRUE:
+        LVM_JUMP_TO_TARGET();  /* pcを書き換える */
+        LVM_DISPATCH();
+      LVM_CASE(LVM_JUMP_IF_TRUE):
         /* トップの値がTRUEならばジャンプ. トップは捨てる */
-        if (stack[--top].u.boolean_value == LL1LL_TRUE) {
-          pc = inst.u.jump_pc;
+        if (get_boolean_value(stack[--top]) == LL1LL_TRUE) {
+          LVM_JUMP_TO_TARGET();
         }
-        break;
-      case LVM_JUMP_IF_FALSE:
+        LVM_DISPATCH();
+      LVM_CASE(LVM_JUMP_IF_FALSE):
         /* トップの値がFALSEならばジャンプ. トップは捨てる */
-        if (stack[--top].u.boolean_value == LL1LL_FALSE) {
-          pc = inst.u.jump_pc;
+        if (get_boolean_value(stack[--top]) == LL1LL_FALSE) {
+          LVM_JUMP_TO_TARGET();
         }
-        break;
-      case LVM_INVOKE:
-        /* 関数呼び出し */
-        temp_level = inst.u.address.block_level + 1;    /* 関数ブロック内のレベルは呼び出したブロック+1 */
-        /* stack[top].u.int_value   = display[temp_level];  ディスプレイの退避 */
-        stack[top].type          = LL1LL_INT_TYPE;
-        stack[top].u.int_value   = getDisplayAt(temp_level);
-        stack[top+1].type        = LL1LL_INT_TYPE;
-        stack[top+1].u.int_value = pc;                  /* 戻り先のpc(現在のpc) */
-        /* display[temp_level]      = top;                 関数内のディスプレイは現在のtopを指させる */
-        setDisplayAt(temp_level, top);
-        pc = inst.u.address.address;                    /* 関数内部へジャンプ */
-        break;
-      case LVM_RETURN:
+        LVM_DISPATCH();
+      LVM_CASE(LVM_INVOKE):
+        /* 関数呼び出し. GCの安全点(実引数はトップ未満にある) */
+        gcSafePoint();
+        /* 呼び先フレームの最大スタック必要量(入口命令の追加オペランド)だけ空きを確認.
+         * フレーム内の命令はこれ以上スタックを確認しない */
+        if (top + code[inst->u.address.address + 1].u.move_top > stack_size) {
+          growStack(top + code[inst->u.address.address + 1].u.move_top);
+        }
+        temp_level = inst->u.address.block_level + 1;    /* 関数ブロック内のレベルは呼び出したブロック+1 */
+        set_int_value(stack[top], display[temp_level]);   /* ディスプレイの退避 */
+        set_int_value(stack[top+1], pc);                  /* 戻り先のpc(現在のpc) */
+        set_int_value(stack[top+2], base);                /* 呼び出し側のフレーム先頭の退避 */
+        display[temp_level] = top;                        /* 関数内のディスプレイは現在のtopを指させる */
+        base                = top;
+        pc = inst->u.address.address;                    /* 関数内部へジャンプ */
+        LVM_DISPATCH();
+      LVM_CASE(LVM_TAIL_INVOKE):
+        /* 末尾呼び出し:現在のフレームを呼び先のフレームで置き換える.
+         * 実引数を現在の関数の仮引数の位置まで下ろし, 復帰情報(ディスプレイの退避値, 戻り先のpc,
+         * 呼び出し側のフレーム先頭)は現在のフレームのものを引き継ぐ. 呼び先は現在の関数と同じレベル */
+        gcSafePoint();
+        num_args = code[inst->u.address.address + 2].u.move_top;  /* 呼び先の仮引数の数 */
+        new_base = base - inst[1].u.move_top + num_args;          /* 追加オペランドは現在の関数の仮引数の数 */
+        if (new_base + code[inst->u.address.address + 1].u.move_top > stack_size) {
+          growStack(new_base + code[inst->u.address.address + 1].u.move_top);
+        }
+        memcpy(link, &stack[base], sizeof(LL1LL_Value) * FIRST_LOCAL_ADDRESS);
+        memmove(&stack[new_base - num_args], &stack[top - num_args],
+                sizeof(LL1LL_Value) * num_args);
+        memcpy(&stack[new_base], link, sizeof(LL1LL_Value) * FIRST_LOCAL_ADDRESS);
+        display[inst->u.address.block_level + 1] = new_base;
+        base = top = new_base;
+        pc = inst->u.address.address;                    /* 関数内部へジャンプ */
+        LVM_DISPATCH();
+      LVM_CASE(LVM_ENTER):
+        /* 関数(トップレベル)の入口. ローカル変数の分だけトップを移動し, 追加オペランドを飛ばす.
+         * ローカル変数は, 以前のフレームの値(GCで解放済みのオブジェクトかもしれない)が残らないようnullにする */
+        for (slot = top + FIRST_LOCAL_ADDRESS; slot < top + inst->u.move_top; slot++) {
+          set_null(stack[slot]);
+        }
+        top += inst->u.move_top;
+        pc  += 2;
+        LVM_DISPATCH();
+      LVM_CASE(LVM_RETURN):
         /* 関数からのリターン */
         temp_value   = stack[--top];                        /* 戻り値の確保 */
-        /* top          = display[inst.u.address.block_level];  スタックトップを呼び出し側の値に戻す */
-        top          = getDisplayAt(inst.u.address.block_level);
-        /* display[inst.u.address.block_level] = stack[top].u.int_value;   ディスプレイ情報の復帰 */
-        setDisplayAt(inst.u.address.block_level, stack[top].u.int_value);
-        pc           = stack[top+1].u.int_value;                        /* 戻り先のpcにセット */
-        top         -= inst.u.address.address;              /* 実引数の数だけトップを移動 */
+        top          = base;                                /* スタックトップを呼び出し側の値に戻す */
+        display[inst->u.address.block_level] = get_int_value(stack[top]); /* ディスプレイ情報の復帰 */
+        pc           = get_int_value(stack[top+1]);         /* 戻り先のpcにセット */
+        base         = get_int_value(stack[top+2]);         /* 呼び出し側のフレームに戻る */
+        top         -= inst->u.address.address;              /* 実引数の数だけトップを移動 */
         stack[top++] = temp_value;                          /* 戻り値をトップにセット */
-        break;
+        LVM_DISPATCH();
         /* 単項演算命令 -> サブルーチンに投げる */
-      case LVM_MINUS:       /* FALLTHRU */
-      case LVM_LOGICAL_NOT: /* FALLTHRU */
-      case LVM_INCREMENT:   /* FALLTHRU */
-      case LVM_DECREMENT:
+      LVM_CASE(LVM_MINUS):       /* FALLTHRU */
+      LVM_CASE(LVM_LOGICAL_NOT): /* FALLTHRU */
+      LVM_CASE(LVM_INCREMENT):   /* FALLTHRU */
+      LVM_CASE(LVM_DECREMENT):
         stack[top-1]
-          = do_single_calc(stack[top-1], inst.opcode);
-          break;
+          = do_single_calc(stack[top-1], inst->opcode);
+        LVM_DISPATCH();
         /* 演算命令 -> サブルーチンに投げる */
-      case LVM_ADD:         /* FALLTHRU */
-      case LVM_SUB:         /* FALLTHRU */
-      case LVM_MUL:         /* FALLTHRU */
-      case LVM_DIV:         /* FALLTHRU */
-      case LVM_MOD:         /* FALLTHRU */
-      case LVM_POW:         /* FALLTHRU */
-      case LVM_LOGICAL_AND: /* FALLTHRU */
-      case LVM_LOGICAL_OR:
+      LVM_CASE(LVM_ADD):         /* FALLTHRU */
+      LVM_CASE(LVM_SUB):         /* FALLTHRU */
+      LVM_CASE(LVM_MUL):         /* FALLTHRU */
+      LVM_CASE(LVM_DIV):         /* FALLTHRU */
+      LVM_CASE(LVM_MOD):         /* FALLTHRU */
+      LVM_CASE(LVM_POW):         /* FALLTHRU */
+      LVM_CASE(LVM_LOGICAL_AND): /* FALLTHRU */
+      LVM_CASE(LVM_LOGICAL_OR):
+      calculate:
+        /* オペランドの型を見て, 次回からは型特化命令で実行する */
+        temp_opcode = inst->opcode;
+        LVM_REWRITE(pc-1, quicken(temp_opcode, stack[top-2], stack[top-1]));
         top--;
         stack[top-1] 
-          = do_calculate(stack[top-1], stack[top], inst.opcode);
-        break;
+          = do_calculate(stack[top-1], stack[top], temp_opcode);
+        LVM_DISPATCH();
+        /* 文字列連結の連鎖 -> サブルーチンに投げる. 連結した値の並びが結果一つに置き換わる */
+      LVM_CASE(LVM_CONCAT_N):
+        temp_value = do_concat(&stack[top - inst->u.concat_count], inst->u.concat_count);
+        top -= inst->u.concat_count - 1;
+        stack[top-1] = temp_value;
+        LVM_DISPATCH();
         /* 比較命令 -> サブルーチンに投げる */
-      case LVM_EQUAL:         /* FALLTHRU */
-      case LVM_NOT_EQUAL:     /* FALLTHRU */ 
-      case LVM_GREATER:       /* FALLTHRU */
-      case LVM_GREATER_EQUAL: /* FALLTHRU */
-      case LVM_LESSTHAN:      /* FALLTHRU */
-      case LVM_LESSTHAN_EQUAL:
+      LVM_CASE(LVM_EQUAL):         /* FALLTHRU */
+      LVM_CASE(LVM_NOT_EQUAL):     /* FALLTHRU */ 
+      LVM_CASE(LVM_GREATER):       /* FALLTHRU */
+      LVM_CASE(LVM_GREATER_EQUAL): /* FALLTHRU */
+      LVM_CASE(LVM_LESSTHAN):      /* FALLTHRU */
+      LVM_CASE(LVM_LESSTHAN_EQUAL):
+      compare:
+        /* オペランドの型を見て, 次回からは型特化命令で実行する */
+        temp_opcode = inst->opcode;
+        LVM_REWRITE(pc-1, quicken(temp_opcode, stack[top-2], stack[top-1]));
         top--;
         stack[top-1] 
-          = do_compare(stack[top-1], stack[top], inst.opcode);
-        break;
+          = do_compare(stack[top-1], stack[top], temp_opcode);
+        LVM_DISPATCH();
+        /* 型特化した演算命令 */
+      LVM_CASE(LVM_ADD_INT_INT):
+        LVM_QUICKENED(LL1LL_INT_TYPE, LL1LL_INT_TYPE,
+            set_int_value(stack[top-1],
+                get_int_value(stack[top-1]) + get_int_value(stack[top])),
+            LVM_ADD, calculate);
+      LVM_CASE(LVM_ADD_DBL_DBL):
+        LVM_QUICKENED(LL1LL_DOUBLE_TYPE, LL1LL_DOUBLE_TYPE,
+            set_double_value(stack[top-1],
+                get_double_value(stack[top-1]) + get_double_value(stack[top])),
+            LVM_ADD, calculate);
+      LVM_CASE(LVM_SUB_INT_INT):
+        LVM_QUICKENED(LL1LL_INT_TYPE, LL1LL_INT_TYPE,
+            set_int_value(stack[top-1],
+                get_int_value(stack[top-1]) - get_int_value(stack[top])),
+            LVM_SUB, calculate);
+      LVM_CASE(LVM_SUB_DBL_DBL):
+        LVM_QUICKENED(LL1LL_DOUBLE_TYPE, LL1LL_DOUBLE_TYPE,
+            set_double_value(stack[top-1],
+                get_double_value(stack[top-1]) - get_double_value(stack[top])),
+            LVM_SUB, calculate);
+      LVM_CASE(LVM_MUL_INT_INT):
+        LVM_QUICKENED(LL1LL_INT_TYPE, LL1LL_INT_TYPE,
+            set_int_value(stack[top-1],
+                get_int_value(stack[top-1]) * get_int_value(stack[top])),
+            LVM_MUL, calculate);
+      LVM_CASE(LVM_MUL_DBL_DBL):
+        LVM_QUICKENED(LL1LL_DOUBLE_TYPE, LL1LL_DOUBLE_TYPE,
+            set_double_value(stack[top-1],
+                get_double_value(stack[top-1]) * get_double_value(stack[top])),
+            LVM_MUL, calculate);
+      LVM_CASE(LVM_CONCAT_STR_STR):
+        /* 文字列は型だけでなくオブジェクトの種類も確認する */
+        if (is_string(stack[top-2]) && is_string(stack[top-1])) {
+          top--;
+          set_object(stack[top-1],
+                     concatString(get_object(stack[top-1]), get_object(stack[top])));
+          LVM_DISPATCH();
+        }
+        LVM_REWRITE(pc-1, LVM_ADD);
+        goto calculate;
+        /* 型特化した比較命令 */
+      LVM_CASE(LVM_EQ_INT_INT):
+        LVM_QUICKENED(LL1LL_INT_TYPE, LL1LL_INT_TYPE,
+            LVM_SET_COMPARE_RESULT(get_int_value(stack[top-1]) == get_int_value(stack[top])),
+            LVM_EQUAL, compare);
+      LVM_CASE(LVM_NE_INT_INT):
+        LVM_QUICKENED(LL1LL_INT_TYPE, LL1LL_INT_TYPE,
+            LVM_SET_COMPARE_RESULT(get_int_value(stack[top-1]) != get_int_value(stack[top])),
+            LVM_NOT_EQUAL, compare);
+      LVM_CASE(LVM_GT_INT_INT):
+        LVM_QUICKENED(LL1LL_INT_TYPE, LL1LL_INT_TYPE,
+            LVM_SET_COMPARE_RESULT(get_int_value(stack[top-1]) > get_int_value(stack[top])),
+            LVM_GREATER, compare);
+      LVM_CASE(LVM_GE_INT_INT):
+        LVM_QUICKENED(LL1LL_INT_TYPE, LL1LL_INT_TYPE,
+            LVM_SET_COMPARE_RESULT(get_int_value(stack[top-1]) >= get_int_value(stack[top])),
+            LVM_GREATER_EQUAL, compare);
+      LVM_CASE(LVM_LT_INT_INT):
+        LVM_QUICKENED(LL1LL_INT_TYPE, LL1LL_INT_TYPE,
+            LVM_SET_COMPARE_RESULT(get_int_value(stack[top-1]) < get_int_value(stack[top])),
+            LVM_LESSTHAN, compare);
+      LVM_CASE(LVM_LE_INT_INT):
+        LVM_QUICKENED(LL1LL_INT_TYPE, LL1LL_INT_TYPE,
+            LVM_SET_COMPARE_RESULT(get_int_value(stack[top-1]) <= get_int_value(stack[top])),
+            LVM_LESSTHAN_EQUAL, compare);
+      LVM_CASE(LVM_GT_DBL_DBL):
+        LVM_QUICKENED(LL1LL_DOUBLE_TYPE, LL1LL_DOUBLE_TYPE,
+            LVM_SET_COMPARE_RESULT(get_double_value(stack[top-1]) > get_double_value(stack[top])),
+            LVM_GREATER, compare);
+      LVM_CASE(LVM_GE_DBL_DBL):
+        LVM_QUICKENED(LL1LL_DOUBLE_TYPE, LL1LL_DOUBLE_TYPE,
+            LVM_SET_COMPARE_RESULT(get_double_value(stack[top-1]) >= get_double_value(stack[top])),
+            LVM_GREATER_EQUAL, compare);
+      LVM_CASE(LVM_LT_DBL_DBL):
+        LVM_QUICKENED(LL1LL_DOUBLE_TYPE, LL1LL_DOUBLE_TYPE,
+            LVM_SET_COMPARE_RESULT(get_double_value(stack[top-1]) < get_double_value(stack[top])),
+            LVM_LESSTHAN, compare);
+      LVM_CASE(LVM_LE_DBL_DBL):
+        LVM_QUICKENED(LL1LL_DOUBLE_TYPE, LL1LL_DOUBLE_TYPE,
+            LVM_SET_COMPARE_RESULT(get_double_value(stack[top-1]) <= get_double_value(stack[top])),
+            LVM_LESSTHAN_EQUAL, compare);
         /* ストリームにポップ */
-      case LVM_POP_TO_STREAM:
+      LVM_CASE(LVM_POP_TO_STREAM):
         top--;
         stack[top-1]
           = do_put_stream(stack[top-1], stack[top]);
-        break;
+        LVM_DISPATCH();
         /* ストリームからプッシュ */
-      case LVM_PUSH_FROM_STREAM:
+      LVM_CASE(LVM_PUSH_FROM_STREAM):
         /* TODO:これは考察すべき. どの関数を使うか. */
-        break;
+        LVM_DISPATCH();
+        /* スーパー命令 */
+      LVM_CASE(LVM_ADD_LOCAL_IMM):
+        /* 変数+即値をプッシュ. 即値は次の命令語(追加オペランド)にある */
+        temp_value = LVM_VARIABLE(inst->u.address);
+        if (get_type(temp_value) == LL1LL_INT_TYPE
+            && get_type(constants[inst[1].u.const_index]) == LL1LL_INT_TYPE) {
+          set_int_value(temp_value,
+                        get_int_value(temp_value) + get_int_value(constants[inst[1].u.const_index]));
+        } else {
+          temp_value = do_calculate(temp_value, constants[inst[1].u.const_index], LVM_ADD);
+        }
+        stack[top++] = temp_value;
+        pc++;  /* 追加オペランドを飛ばす */
+        LVM_DISPATCH();
+      LVM_CASE(LVM_SUB_LOCAL_IMM):
+        /* 変数-即値をプッシュ */
+        temp_value = LVM_VARIABLE(inst->u.address);
+        if (get_type(temp_value) == LL1LL_INT_TYPE
+            && get_type(constants[inst[1].u.const_index]) == LL1LL_INT_TYPE) {
+          set_int_value(temp_value,
+                        get_int_value(temp_value) - get_int_value(constants[inst[1].u.const_index]));
+        } else {
+          temp_value = do_calculate(temp_value, constants[inst[1].u.const_index], LVM_SUB);
+        }
+        stack[top++] = temp_value;
+        pc++;
+        LVM_DISPATCH();
+      LVM_CASE(LVM_INC_LOCAL):
+        /* 変数をその場で1増加 */
+        var_p = &LVM_VARIABLE(inst->u.address);
+        if (get_type(*var_p) == LL1LL_INT_TYPE) {
+          set_int_value(*var_p, get_int_value(*var_p) + 1);
+        } else {
+          *var_p = do_single_calc(*var_p, LVM_INCREMENT);
+        }
+        LVM_DISPATCH();
+      LVM_CASE(LVM_DEC_LOCAL):
+        /* 変数をその場で1減少 */
+        var_p = &LVM_VARIABLE(inst->u.address);
+        if (get_type(*var_p) == LL1LL_INT_TYPE) {
+          set_int_value(*var_p, get_int_value(*var_p) - 1);
+        } else {
+          *var_p = do_single_calc(*var_p, LVM_DECREMENT);
+        }
+        LVM_DISPATCH();
+        /* 比較分岐命令. 一つ下とトップを比較 */
+      LVM_CASE(LVM_JLT):
+        top -= 2;
+        LVM_COMPARE_JUMP(LVM_JLT, stack[top], stack[top+1], 0);
+      LVM_CASE(LVM_JLE):
+        top -= 2;
+        LVM_COMPARE_JUMP(LVM_JLE, stack[top], stack[top+1], 0);
+      LVM_CASE(LVM_JGT):
+        top -= 2;
+        LVM_COMPARE_JUMP(LVM_JGT, stack[top], stack[top+1], 0);
+      LVM_CASE(LVM_JGE):
+        top -= 2;
+        LVM_COMPARE_JUMP(LVM_JGE, stack[top], stack[top+1], 0);
+      LVM_CASE(LVM_JEQ):
+        top -= 2;
+        LVM_COMPARE_JUMP(LVM_JEQ, stack[top], stack[top+1], 0);
+      LVM_CASE(LVM_JNE):
+        top -= 2;
+        LVM_COMPARE_JUMP(LVM_JNE, stack[top], stack[top+1], 0);
+        /* 比較分岐命令の即値版. トップと追加オペランドの即値を比較 */
+      LVM_CASE(LVM_JLT_IMM):
+        top--;
+        LVM_COMPARE_JUMP(LVM_JLT, stack[top], constants[inst[1].u.const_index], 1);
+      LVM_CASE(LVM_JLE_IMM):
+        top--;
+        LVM_COMPARE_JUMP(LVM_JLE, stack[top], constants[inst[1].u.const_index], 1);
+      LVM_CASE(LVM_JGT_IMM):
+        top--;
+        LVM_COMPARE_JUMP(LVM_JGT, stack[top], constants[inst[1].u.const_index], 1);
+      LVM_CASE(LVM_JGE_IMM):
+        top--;
+        LVM_COMPARE_JUMP(LVM_JGE, stack[top], constants[inst[1].u.const_index], 1);
+      LVM_CASE(LVM_JEQ_IMM):
+        top--;
+        LVM_COMPARE_JUMP(LVM_JEQ, stack[top], constants[inst[1].u.const_index], 1);
+      LVM_CASE(LVM_JNE_IMM):
+        top--;
+        LVM_COMPARE_JUMP(LVM_JNE, stack[top], constants[inst[1].u.const_index], 1);
+        /* 比較分岐命令の変数版. トップと追加オペランドのアドレスの変数を比較 */
+      LVM_CASE(LVM_JLT_LOCAL):
+        top--;
+        LVM_COMPARE_JUMP(LVM_JLT, stack[top],
+                         LVM_VARIABLE(inst[1].u.address), 1);
+      LVM_CASE(LVM_JLE_LOCAL):
+        top--;
+        LVM_COMPARE_JUMP(LVM_JLE, stack[top],
+                         LVM_VARIABLE(inst[1].u.address), 1);
+      LVM_CASE(LVM_JGT_LOCAL):
+        top--;
+        LVM_COMPARE_JUMP(LVM_JGT, stack[top],
+                         LVM_VARIABLE(inst[1].u.address), 1);
+      LVM_CASE(LVM_JGE_LOCAL):
+        top--;
+        LVM_COMPARE_JUMP(LVM_JGE, stack[top],
+                         LVM_VARIABLE(inst[1].u.address), 1);
+      LVM_CASE(LVM_JEQ_LOCAL):
+        top--;
+        LVM_COMPARE_JUMP(LVM_JEQ, stack[top],
+                         LVM_VARIABLE(inst[1].u.address), 1);
+      LVM_CASE(LVM_JNE_LOCAL):
+        top--;
+        LVM_COMPARE_JUMP(LVM_JNE, stack[top],
+                         LVM_VARIABLE(inst[1].u.address), 1);
+        /* 実行終了 */
+      LVM_CASE(LVM_HALT):
+        goto halt;
+        /* 追加オペランドは命令として実行されることはない */
+      LVM_CASE(LVM_OPERAND):
+#ifndef LVM_THREADED_CODE
       default:
+#endif /* LVM_THREADED_CODE */
         fprintf(stderr, "Error! Invailed opecode \n");
         exit(EXIT_FAILURE);
+#ifndef LVM_THREADED_CODE
     }
 
     /* デバッグ用, スタックの状態を表示 */
@@ -180,10 +644,15 @@ void execute(void)
        printf("pc : %4d ", pc);
        printCode(pc);
      */
-  } while (pc <= code_size);
-  /* } while (pc != 0); */
+  }
+#endif /* LVM_THREADED_CODE */
 
+halt:
+#ifdef LVM_THREADED_CODE
+  MEM_free(threaded);
+#endif /* LVM_THREADED_CODE */
   /* TODO:*code の解放 */
+  return;
 }
 
 /* 単項演算の実行 */
@@ -196,14 +665,12 @@ do_single_calc(LL1LL_Value term, LVM_OpCode code)
   switch (code) {
     case LVM_MINUS:
       /* 単項マイナス */
-      switch (term.type) {
+      switch (get_type(term)) {
         case LL1LL_INT_TYPE:
-          ret_value.type        = LL1LL_INT_TYPE;
-          ret_value.u.int_value = -term.u.int_value;
+          set_int_value(ret_value, -get_int_value(term));
           break;
         case LL1LL_DOUBLE_TYPE:
-          ret_value.type           = LL1LL_DOUBLE_TYPE;
-          ret_value.u.double_value = -term.u.double_value;
+          set_double_value(ret_value, -get_double_value(term));
           break;
         default:
           fprintf(stderr, "Invailed type for single term minus \n");
@@ -212,12 +679,11 @@ do_single_calc(LL1LL_Value term, LVM_OpCode code)
       break;
     case LVM_LOGICAL_NOT:
       /* 単項論理否定 */
-      if (term.type == LL1LL_BOOLEAN_TYPE) {
-        ret_value.type = LL1LL_BOOLEAN_TYPE;
-        if (term.u.boolean_value == LL1LL_TRUE) {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+      if (get_type(term) == LL1LL_BOOLEAN_TYPE) {
+        if (get_boolean_value(term) == LL1LL_TRUE) {
+          set_boolean_value(ret_value, LL1LL_FALSE);
         } else {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+          set_boolean_value(ret_value, LL1LL_TRUE);
         }
       } else {
         fprintf(stderr, "Invailed type for single term logical not \n");
@@ -226,9 +692,8 @@ do_single_calc(LL1LL_Value term, LVM_OpCode code)
       break;
     case LVM_INCREMENT:
       /* 単項インクリメント */
-      if (term.type == LL1LL_INT_TYPE) {
-        ret_value.type = LL1LL_INT_TYPE;
-        ret_value.u.int_value = term.u.int_value + 1;
+      if (get_type(term) == LL1LL_INT_TYPE) {
+        set_int_value(ret_value, get_int_value(term) + 1);
       } else {
         fprintf(stderr, "Invailed type for single term increment \n");
         exit(EXIT_FAILURE);
@@ -236,9 +701,8 @@ do_single_calc(LL1LL_Value term, LVM_OpCode code)
       break;
     case LVM_DECREMENT:
       /* 単項デクリメント */
-      if (term.type == LL1LL_INT_TYPE) {
-        ret_value.type = LL1LL_INT_TYPE;
-        ret_value.u.int_value = term.u.int_value - 1;
+      if (get_type(term) == LL1LL_INT_TYPE) {
+        set_int_value(ret_value, get_int_value(term) - 1);
       } else {
         fprintf(stderr, "Invailed type for single term decrement \n");
         exit(EXIT_FAILURE);
@@ -258,71 +722,69 @@ do_calculate(LL1LL_Value left, LL1LL_Value right, LVM_OpCode code)
 {
 
   char str_buf[RUNTIME_STR_BUF_SIZE]; /* 文字列バッファ */
-  LL1LL_Value ret_value;              /* 結果のテンポラリ */
-  ret_value.type = left.type;         /* 返す型はとりあえず左辺に合わせる */
+  int str_len;                        /* 文字列バッファの文字列の長さ */
+  char *big_buf;                      /* 文字列バッファに収まらない時のバッファ */
+  LL1LL_Value ret_value = left;       /* 結果のテンポラリ. 返す型はとりあえず左辺に合わせる */
 
   switch (code) {
     case LVM_ADD:
       /* 加算 */
-      if (left.type == LL1LL_INT_TYPE 
-          && right.type == LL1LL_INT_TYPE) {
+      if (get_type(left) == LL1LL_INT_TYPE 
+          && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がint, 右辺がint */
-        ret_value.u.int_value = left.u.int_value + right.u.int_value;
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_INT_TYPE) {
+        set_int_value(ret_value, get_int_value(left) + get_int_value(right));
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がdouble, 右辺がint */
-        ret_value.u.double_value = left.u.double_value + (double)right.u.int_value;
-      } else if (left.type == LL1LL_INT_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+        set_double_value(ret_value, get_double_value(left) + (double)get_int_value(right));
+      } else if (get_type(left) == LL1LL_INT_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がint, 右辺がdouble */
-        ret_value.type = LL1LL_DOUBLE_TYPE;
-        ret_value.u.double_value = (double)left.u.int_value + right.u.int_value;
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+        set_double_value(ret_value, (double)get_int_value(left) + get_double_value(right));
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がdouble, 右辺がdouble */
-        ret_value.u.double_value = left.u.double_value + right.u.double_value;
-      } else if (left.type == LL1LL_BOOLEAN_TYPE
-                 && right.type == LL1LL_BOOLEAN_TYPE) {
+        set_double_value(ret_value, get_double_value(left) + get_double_value(right));
+      } else if (get_type(left) == LL1LL_BOOLEAN_TYPE
+                 && get_type(right) == LL1LL_BOOLEAN_TYPE) {
         /* 左辺がboolean, 右辺がboolean */
-        if (left.u.boolean_value == LL1LL_TRUE) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_boolean_value(left) == LL1LL_TRUE) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = right.u.boolean_value;
+          set_boolean_value(ret_value, get_boolean_value(right));
         }
       } else if (is_string(left)
-                 && right.type == LL1LL_INT_TYPE) {
-        /* 左辺がstring, 右辺がint */
-        /* 数字を文字列に変換 */
-        sprintf(str_buf, "%d", right.u.int_value);
-        /* 文字列を連結し,結果のオブジェクト参照を取得 */
-        ret_value.u.object
-          = cat_string(get_string_value(left), str_buf);
-      } else if (is_string(left)
-                 && right.type == LL1LL_DOUBLE_TYPE) {
-        /* 左辺がstring, 右辺がdouble */
-        /* 数字を文字列に変換 */
-        sprintf(str_buf, "%f", right.u.double_value);
-        /* 文字列を連結 */
-        left.u.object
-          = cat_string(get_string_value(left), str_buf);
-        ret_value = left;
+                 && (get_type(right) == LL1LL_INT_TYPE
+                     || get_type(right) == LL1LL_DOUBLE_TYPE)) {
+        /* 左辺がstring, 右辺がintかdouble */
+        /* 数字を文字列に変換. バッファに収まらない(とても大きな実数の)時は, 長さ分確保して書き直す */
+        str_len = formatNumber(right, str_buf, RUNTIME_STR_BUF_SIZE);
+        if (str_len >= RUNTIME_STR_BUF_SIZE) {
+          big_buf = (char *)MEM_malloc(str_len + 1);
+          formatNumber(right, big_buf, str_len + 1);
+          set_object(ret_value, appendString(get_object(left), big_buf, str_len));
+          MEM_free(big_buf);
+        } else {
+          /* 文字列を連結し,結果のオブジェクト参照を取得 */
+          set_object(ret_value, appendString(get_object(left), str_buf, str_len));
+        }
       } else if (is_string(left)
-                 && right.type == LL1LL_BOOLEAN_TYPE) {
+                 && get_type(right) == LL1LL_BOOLEAN_TYPE) {
         /* 左辺がstring, 右辺がboolean */
-        if (right.u.boolean_value == LL1LL_TRUE) {
-          strcat(str_buf, "true");
+        if (get_boolean_value(right) == LL1LL_TRUE) {
+          strcpy(str_buf, "true");
+          str_len = 4;
         } else {
           strcpy(str_buf, "false");
+          str_len = 5;
         }
         /* 文字列を連結 */
-        left.u.object
-          = cat_string(get_string_value(left), str_buf);
+        set_object(left, appendString(get_object(left), str_buf, str_len));
         ret_value = left;
       } else if (is_string(left) && is_string(right)) {
         /* 左辺がstring, 右辺がstring */
         /* 文字列を連結 */
-        left.u.object
-          = cat_string(get_string_value(left), get_string_value(right));
+        set_object(left, concatString(get_object(left), get_object(right)));
         /* 参照も同時に渡すので, 多分大丈夫 */
         ret_value = left;
       } else {
@@ -333,30 +795,29 @@ do_calculate(LL1LL_Value left, LL1LL_Value right, LVM_OpCode code)
       break;
     case LVM_SUB:
       /* 減算 */
-      if (left.type == LL1LL_INT_TYPE 
-          && right.type == LL1LL_INT_TYPE) {
+      if (get_type(left) == LL1LL_INT_TYPE 
+          && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がint, 右辺がint */
-        ret_value.u.int_value = left.u.int_value - right.u.int_value;
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_INT_TYPE) {
+        set_int_value(ret_value, get_int_value(left) - get_int_value(right));
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がdouble, 右辺がint */
-        ret_value.u.double_value = left.u.double_value - (double)right.u.int_value;
-      } else if (left.type == LL1LL_INT_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+        set_double_value(ret_value, get_double_value(left) - (double)get_int_value(right));
+      } else if (get_type(left) == LL1LL_INT_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がint, 右辺がdouble */
-        ret_value.type = LL1LL_DOUBLE_TYPE;
-        ret_value.u.double_value = (double)left.u.int_value - right.u.int_value;
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+        set_double_value(ret_value, (double)get_int_value(left) - get_double_value(right));
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がdouble, 右辺がdouble */
-        ret_value.u.double_value = left.u.double_value - right.u.double_value;
-      } else if (left.type == LL1LL_BOOLEAN_TYPE
-                 && right.type == LL1LL_BOOLEAN_TYPE) {
+        set_double_value(ret_value, get_double_value(left) - get_double_value(right));
+      } else if (get_type(left) == LL1LL_BOOLEAN_TYPE
+                 && get_type(right) == LL1LL_BOOLEAN_TYPE) {
         /* 左辺がboolean, 右辺がboolean */
-        if (right.u.boolean_value == LL1LL_TRUE) {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+        if (get_boolean_value(right) == LL1LL_TRUE) {
+          set_boolean_value(ret_value, LL1LL_FALSE);
         } else {
-          ret_value.u.boolean_value = left.u.boolean_value;
+          set_boolean_value(ret_value, get_boolean_value(left));
         }
       } else {
         /* 減算の型エラー */
@@ -366,33 +827,32 @@ do_calculate(LL1LL_Value left, LL1LL_Value right, LVM_OpCode code)
       break;
     case LVM_MUL:
       /* 積算 */
-      if (left.type == LL1LL_INT_TYPE 
-          && right.type == LL1LL_INT_TYPE) {
+      if (get_type(left) == LL1LL_INT_TYPE 
+          && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がint, 右辺がint */
-        ret_value.u.int_value = left.u.int_value * right.u.int_value;
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_INT_TYPE) {
+        set_int_value(ret_value, get_int_value(left) * get_int_value(right));
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がdouble, 右辺がint */
-        ret_value.u.double_value = left.u.double_value * (double)right.u.int_value;
-      } else if (left.type == LL1LL_INT_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+        set_double_value(ret_value, get_double_value(left) * (double)get_int_value(right));
+      } else if (get_type(left) == LL1LL_INT_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がint, 右辺がdouble */
-        ret_value.type = LL1LL_DOUBLE_TYPE;
-        ret_value.u.double_value = (double)left.u.int_value * right.u.int_value;
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+        set_double_value(ret_value, (double)get_int_value(left) * get_double_value(right));
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がdouble, 右辺がdouble */
-        ret_value.u.double_value = left.u.double_value * right.u.double_value;
-      } else if (left.type == LL1LL_BOOLEAN_TYPE
-                 && right.type == LL1LL_BOOLEAN_TYPE) {
+        set_double_value(ret_value, get_double_value(left) * get_double_value(right));
+      } else if (get_type(left) == LL1LL_BOOLEAN_TYPE
+                 && get_type(right) == LL1LL_BOOLEAN_TYPE) {
         /* 左辺がboolean, 右辺がboolean */
-        if (left.u.boolean_value == LL1LL_TRUE) {
-          ret_value.u.boolean_value = right.u.boolean_value;
+        if (get_boolean_value(left) == LL1LL_TRUE) {
+          set_boolean_value(ret_value, get_boolean_value(right));
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
       } else if (is_string(left)
-                 && right.type == LL1LL_INT_TYPE) {
+                 && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がstring, 右辺がint */
         /* -> 文字列を整数回繰り返す */
       } else {
@@ -403,27 +863,26 @@ do_calculate(LL1LL_Value left, LL1LL_Value right, LVM_OpCode code)
       break;
     case LVM_DIV:
       /* 除算 */
-      if (left.type == LL1LL_INT_TYPE 
-          && right.type == LL1LL_INT_TYPE) {
+      if (get_type(left) == LL1LL_INT_TYPE 
+          && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がint, 右辺がint */
-        if (right.u.int_value == 0) {
+        if (get_int_value(right) == 0) {
           fprintf(stderr, "Zero division detected! \n");
           exit(EXIT_FAILURE);
         }
-        ret_value.u.int_value = left.u.int_value / right.u.int_value;
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_INT_TYPE) {
+        set_int_value(ret_value, get_int_value(left) / get_int_value(right));
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がdouble, 右辺がint */
-        ret_value.u.double_value = left.u.double_value / (double)right.u.int_value;
-      } else if (left.type == LL1LL_INT_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+        set_double_value(ret_value, get_double_value(left) / (double)get_int_value(right));
+      } else if (get_type(left) == LL1LL_INT_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がint, 右辺がdouble */
-        ret_value.type = LL1LL_DOUBLE_TYPE;
-        ret_value.u.double_value = (double)left.u.int_value / right.u.int_value;
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+        set_double_value(ret_value, (double)get_int_value(left) / get_double_value(right));
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がdouble, 右辺がdouble */
-        ret_value.u.double_value = left.u.double_value / right.u.double_value;
+        set_double_value(ret_value, get_double_value(left) / get_double_value(right));
       } else {
         /* 除算の型エラー */
         fprintf(stderr, "Error! Invailed type in div \n");
@@ -432,27 +891,26 @@ do_calculate(LL1LL_Value left, LL1LL_Value right, LVM_OpCode code)
       break;
     case LVM_MOD:
       /* 余算 */
-      if (left.type == LL1LL_INT_TYPE 
-          && right.type == LL1LL_INT_TYPE) {
+      if (get_type(left) == LL1LL_INT_TYPE 
+          && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がint, 右辺がint */
-        if (right.u.int_value == 0) {
+        if (get_int_value(right) == 0) {
           fprintf(stderr, "Zero modulo detected! \n");
           exit(EXIT_FAILURE);
         }
-        ret_value.u.int_value = left.u.int_value % right.u.int_value;
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_INT_TYPE) {
+        set_int_value(ret_value, get_int_value(left) % get_int_value(right));
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がdouble, 右辺がint */
-        ret_value.u.double_value = fmod(left.u.double_value, (double)right.u.int_value);
-      } else if (left.type == LL1LL_INT_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+        set_double_value(ret_value, fmod(get_double_value(left), (double)get_int_value(right)));
+      } else if (get_type(left) == LL1LL_INT_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がint, 右辺がdouble */
-        ret_value.type = LL1LL_DOUBLE_TYPE;
-        ret_value.u.double_value = fmod((double)left.u.int_value, right.u.double_value);
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+        set_double_value(ret_value, fmod((double)get_int_value(left), get_double_value(right)));
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がdouble, 右辺がdouble */
-        ret_value.u.double_value = fmod(left.u.double_value, right.u.double_value);
+        set_double_value(ret_value, fmod(get_double_value(left), get_double_value(right)));
       } else {
         /* 除算の型エラー */
         fprintf(stderr, "Error! Invailed type in mod \n");
@@ -461,31 +919,30 @@ do_calculate(LL1LL_Value left, LL1LL_Value right, LVM_OpCode code)
       break;
     case LVM_POW:
       /* 累乗 */
-      if (left.type == LL1LL_INT_TYPE 
-          && right.type == LL1LL_INT_TYPE) {
+      if (get_type(left) == LL1LL_INT_TYPE 
+          && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がint, 右辺がint */
-        if (left.u.int_value == 0) {
+        if (get_int_value(left) == 0) {
           fprintf(stderr, "Zero power detected! \n");
           exit(EXIT_FAILURE);
         }
-        ret_value.u.int_value = (int)pow((double)left.u.int_value,
-                                         (double)right.u.int_value);
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_INT_TYPE) {
+        set_int_value(ret_value, (int)pow((double)get_int_value(left),
+                                         (double)get_int_value(right)));
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がdouble, 右辺がint */
-        ret_value.u.double_value = pow(left.u.double_value,
-                                       (double)right.u.int_value);
-      } else if (left.type == LL1LL_INT_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+        set_double_value(ret_value, pow(get_double_value(left),
+                                       (double)get_int_value(right)));
+      } else if (get_type(left) == LL1LL_INT_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がint, 右辺がdouble */
-        ret_value.type = LL1LL_DOUBLE_TYPE;
-        ret_value.u.double_value = pow((double)left.u.int_value,
-                                       right.u.double_value);
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+        set_double_value(ret_value, pow((double)get_int_value(left),
+                                       get_double_value(right)));
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がdouble, 右辺がdouble */
-        ret_value.u.double_value = pow(left.u.double_value,
-                                       right.u.double_value);
+        set_double_value(ret_value, pow(get_double_value(left),
+                                       get_double_value(right)));
       } else {
         /* 累乗の型エラー */
         fprintf(stderr, "Error! Invailed type in pow \n");
@@ -494,13 +951,13 @@ do_calculate(LL1LL_Value left, LL1LL_Value right, LVM_OpCode code)
       break;
     case LVM_LOGICAL_AND:
       /* 論理積 */
-      if (left.type == LL1LL_BOOLEAN_TYPE 
-          && right.type == LL1LL_BOOLEAN_TYPE) {
+      if (get_type(left) == LL1LL_BOOLEAN_TYPE 
+          && get_type(right) == LL1LL_BOOLEAN_TYPE) {
         /* 左辺がboolean, 右辺がboolean */
-        if (left.u.boolean_value == LL1LL_FALSE) {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+        if (get_boolean_value(left) == LL1LL_FALSE) {
+          set_boolean_value(ret_value, LL1LL_FALSE);
         } else {
-          ret_value.u.boolean_value = right.u.boolean_value;
+          set_boolean_value(ret_value, get_boolean_value(right));
         }
       } else {
         /* 論理積の型エラー */
@@ -510,13 +967,13 @@ do_calculate(LL1LL_Value left, LL1LL_Value right, LVM_OpCode code)
       break;
     case LVM_LOGICAL_OR:
       /* 論理和 */
-      if (left.type == LL1LL_BOOLEAN_TYPE 
-          && right.type == LL1LL_BOOLEAN_TYPE) {
+      if (get_type(left) == LL1LL_BOOLEAN_TYPE 
+          && get_type(right) == LL1LL_BOOLEAN_TYPE) {
         /* 左辺がboolean, 右辺がboolean */
-        if (left.u.boolean_value == LL1LL_TRUE) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_boolean_value(left) == LL1LL_TRUE) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = right.u.boolean_value;
+          set_boolean_value(ret_value, get_boolean_value(right));
         }
       } else {
         /* 論理積の型エラー */
@@ -532,48 +989,290 @@ do_calculate(LL1LL_Value left, LL1LL_Value right, LVM_OpCode code)
 
 }
 
+/* 文字列連結の連鎖の実行. values[0](文字列)からcount個の値を順に連結した文字列を返す.
+ * 結果の長さを先に求めて一度だけ割り当て, 各値をその中に直接書き写す.
+ * 数値は1回目の走査で文字列にしてconcat_bufに並べておく(終端文字で区切る) */
+static LL1LL_Value
+do_concat(LL1LL_Value *values, int count)
+{
+  int i;
+  int length = 0;                     /* 結果の文字列の長さ */
+  int used   = 0;                     /* concat_bufの使用量 */
+  int str_len;                        /* 値を文字列にした時の長さ */
+  LL1LL_Boolean has_long = LL1LL_FALSE; /* 長い文字列を含むか */
+  LL1LL_Object *result;               /* 結果の文字列 */
+  char *dest;                         /* 結果の中の書き込み位置 */
+  LL1LL_Value ret_value;              /* 結果のテンポラリ */
+
+  if (!is_string(values[0])) {
+    /* 加算の型エラー(コンパイラは文字列の即値から始まる連鎖しか作らない) */
+    fprintf(stderr, "Error! Invailed type in add \n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* 1回目:各値の長さを求める */
+  if (concat_buf_size == 0) {
+    concat_buf_size = RUNTIME_STR_BUF_SIZE;
+    concat_buf      = (char *)MEM_malloc(concat_buf_size);
+  }
+  for (i = 0; i < count; i++) {
+    switch (get_type(values[i])) {
+      case LL1LL_INT_TYPE:    /* FALLTHRU */
+      case LL1LL_DOUBLE_TYPE:
+        /* 収まらなければバッファを広げて書き直す */
+        while ((str_len = formatNumber(values[i], concat_buf + used, concat_buf_size - used))
+               >= concat_buf_size - used) {
+          concat_buf_size = (concat_buf_size + str_len) * 2;
+          concat_buf      = (char *)MEM_realloc(concat_buf, concat_buf_size);
+        }
+        used   += str_len + 1;
+        length += str_len;
+        break;
+      case LL1LL_BOOLEAN_TYPE:
+        length += (get_boolean_value(values[i]) == LL1LL_TRUE) ? 4 : 5;
+        break;
+      default:
+        if (!is_string(values[i])) {
+          /* 加算の型エラー */
+          fprintf(stderr, "Error! Invailed type in add \n");
+          exit(EXIT_FAILURE);
+        }
+        str_len = stringLength(get_object(values[i]));
+        if (str_len >= HEAP_ROPE_MIN_LENGTH) {
+          has_long = LL1LL_TRUE;
+        }
+        length += str_len;
+        break;
+    }
+  }
+
+  /* 長い文字列は書き写さずにロープで繋ぐ方が安いので, 加算と同じく一つずつ連結する */
+  if (has_long) {
+    result = get_object(values[0]);
+    used   = 0;
+    for (i = 1; i < count; i++) {
+      switch (get_type(values[i])) {
+        case LL1LL_INT_TYPE:    /* FALLTHRU */
+        case LL1LL_DOUBLE_TYPE:
+          str_len = strlen(concat_buf + used);
+          result  = appendString(result, concat_buf + used, str_len);
+          used   += str_len + 1;
+          break;
+        case LL1LL_BOOLEAN_TYPE:
+          if (get_boolean_value(values[i]) == LL1LL_TRUE) {
+            result = appendString(result, "true", 4);
+          } else {
+            result = appendString(result, "false", 5);
+          }
+          break;
+        default:
+          result = concatString(result, get_object(values[i]));
+          break;
+      }
+    }
+    set_object(ret_value, result);
+    return ret_value;
+  }
+
+  /* 2回目:結果を一度だけ割り当て, 各値を書き写す */
+  result = alloc_string_length(length);
+  dest   = result->u.str.body->chars;
+  used   = 0;
+  for (i = 0; i < count; i++) {
+    switch (get_type(values[i])) {
+      case LL1LL_INT_TYPE:    /* FALLTHRU */
+      case LL1LL_DOUBLE_TYPE:
+        str_len = strlen(concat_buf + used);
+        memcpy(dest, concat_buf + used, str_len);
+        used += str_len + 1;
+        break;
+      case LL1LL_BOOLEAN_TYPE:
+        if (get_boolean_value(values[i]) == LL1LL_TRUE) {
+          memcpy(dest, "true", 4);
+          str_len = 4;
+        } else {
+          memcpy(dest, "false", 5);
+          str_len = 5;
+        }
+        break;
+      default:
+        copyStringChars(dest, get_object(values[i]));
+        str_len = stringLength(get_object(values[i]));
+        break;
+    }
+    dest += str_len;
+  }
+
+  /* 短い結果は重複を除いたものにする */
+  set_object(ret_value, internString(result));
+  return ret_value;
+}
+
+/* 数値(intかdouble)を文字列にして, 大きさsizeのbufに書き込む.
+ * 書式はprintfの"%d", "%f"と同じ. 返り値はsnprintfと同じく, 収まらなくても文字列全体の長さ */
+static int formatNumber(LL1LL_Value value, char *buf, int size)
+{
+  int int_value;
+  char digits[FORMAT_INT_SIZE];
+  int length;
+
+  if (get_type(value) == LL1LL_DOUBLE_TYPE) {
+    return formatDouble(get_double_value(value), buf, size);
+  }
+
+  /* 整数は高々FORMAT_INT_SIZE-1文字. 収まるなら直接書き込む */
+  int_value = get_int_value(value);
+  if (size >= FORMAT_INT_SIZE) {
+    if (int_value < 0) {
+      buf[0] = '-';
+      return formatDigits(-(int64_t)int_value, buf + 1) + 1;
+    }
+    return formatDigits(int_value, buf);
+  }
+  length = formatNumber(value, digits, FORMAT_INT_SIZE);
+  if (length < size) {
+    memcpy(buf, digits, length + 1);
+  }
+  return length;
+}
+
+/* 符号無し整数valueを10進の文字列(終端文字付き)にしてbufに書き込み, 長さを返す.
+ * 先に桁数を数えてから, 下の桁から2桁ずつ表を引いて書き込む */
+static int formatDigits(uint64_t value, char *buf)
+{
+  static const char pairs[] =
+    "00010203040506070809" "10111213141516171819" "20212223242526272829"
+    "30313233343536373839" "40414243444546474849" "50515253545556575859"
+    "60616263646566676869" "70717273747576777879" "80818283848586878889"
+    "90919293949596979899";
+  uint64_t rest;
+  int length = 1;
+  char *p;
+
+  for (rest = value; rest >= 10; rest /= 10) {
+    length++;
+  }
+  p  = buf + length;
+  *p = '\0';
+  while (value >= 100) {
+    p -= 2;
+    memcpy(p, &pairs[(value % 100) * 2], 2);
+    value /= 100;
+  }
+  if (value >= 10) {
+    p -= 2;
+    memcpy(p, &pairs[value * 2], 2);
+  } else {
+    *--p = (char)('0' + value);
+  }
+  return length;
+}
+
+/* 実数valueをprintfの"%f"と同じ文字列(小数点以下6桁)にして, 大きさsizeのbufに書き込む.
+ * 返り値はsnprintfと同じく, 収まらなくても文字列全体の長さ.
+ * 値は仮数m, 指数eで m * 2^e と正確に表せるので, 10^6倍して最近接偶数に丸めた整数Nを
+ * 128bitの整数演算で正確に求め, Nの10進表記に小数点を挟んで書く(printfと同じ丸めになる).
+ * Nが64bitに収まらない大きな値と, 無限大, NaNはsnprintfに任せる */
+static int formatDouble(double value, char *buf, int size)
+{
+#ifdef __SIZEOF_INT128__
+  char text[FORMAT_DOUBLE_SIZE];  /* 結果. 整数部は高々13桁 */
+  double abs_value = fabs(value);
+  int exponent;
+  uint64_t mantissa;
+  unsigned __int128 scaled;       /* m * 10^6 */
+  unsigned __int128 remainder;
+  unsigned __int128 half;
+  uint64_t rounded = 0;           /* N:値を10^6倍して丸めた整数 */
+  uint64_t fraction;
+  int length = 0;
+  int i;
+
+  if (!(abs_value < 1e13)) {
+    return snprintf(buf, size, "%f", value);
+  }
+
+  if (abs_value != 0.0) {
+    /* abs_value = mantissa * 2^exponent (mantissaは53bit以下の整数) */
+    mantissa = (uint64_t)ldexp(frexp(abs_value, &exponent), 53);
+    exponent -= 53;
+    scaled    = (unsigned __int128)mantissa * 1000000;
+    if (exponent >= 0) {
+      rounded = (uint64_t)(scaled << exponent);
+    } else if (-exponent < 80) {
+      /* 2^-exponentで割って丸める. 余りがちょうど半分なら偶数に(scaled < 2^73なので, それより小さい値は0) */
+      remainder = scaled & (((unsigned __int128)1 << -exponent) - 1);
+      half      = (unsigned __int128)1 << (-exponent - 1);
+      rounded   = (uint64_t)(scaled >> -exponent);
+      if (remainder > half || (remainder == half && (rounded & 1))) {
+        rounded++;
+      }
+    }
+  }
+
+  /* 符号(-0.0や, 丸めて0になる負の値にも付く), 整数部, 小数点, 小数部6桁 */
+  if (signbit(value)) {
+    text[length++] = '-';
+  }
+  length  += formatDigits(rounded / 1000000, text + length);
+  text[length++] = '.';
+  fraction = rounded % 1000000;
+  for (i = 6; i > 0; i--) {
+    text[length + i - 1] = (char)('0' + fraction % 10);
+    fraction /= 10;
+  }
+  length += 6;
+  text[length] = '\0';
+
+  if (length < size) {
+    memcpy(buf, text, length + 1);
+  }
+  return length;
+#else /* __SIZEOF_INT128__ */
+  return snprintf(buf, size, "%f", value);
+#endif /* __SIZEOF_INT128__ */
+}
+
 /* 二項比較演算の実行 */
 static LL1LL_Value 
 do_compare(LL1LL_Value left, LL1LL_Value right, LVM_OpCode code)
 {
 
   LL1LL_Value ret_value;  /* 結果のテンポラリ */
-  ret_value.type = LL1LL_BOOLEAN_TYPE;  /* 返す型は論理型で確定 */
   switch (code) {
     case LVM_EQUAL:
       /* 等号 */
-      if (left.type == LL1LL_BOOLEAN_TYPE
-          && right.type == LL1LL_BOOLEAN_TYPE) {
+      if (get_type(left) == LL1LL_BOOLEAN_TYPE
+          && get_type(right) == LL1LL_BOOLEAN_TYPE) {
         /* 左辺がboolean, 右辺がboolean */
-        if (left.u.boolean_value == right.u.boolean_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_boolean_value(left) == get_boolean_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
-      } else if (left.type == LL1LL_INT_TYPE
-                 && right.type == LL1LL_INT_TYPE) {
+      } else if (get_type(left) == LL1LL_INT_TYPE
+                 && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がint, 右辺がint */
-        if (left.u.int_value == right.u.int_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_int_value(left) == get_int_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がdouble, 右辺がdouble */
-        if (fabs(left.u.double_value - right.u.double_value)
+        if (fabs(get_double_value(left) - get_double_value(right))
             < DBL_EPSILON) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
       } else if (is_string(left) && is_string(right)) {
         /* 左辺がstring, 右辺がstring */
-        if (strcmp(get_string_value(left), 
-                   get_string_value(right)) == 0) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (equalString(get_object(left), get_object(right)) == LL1LL_TRUE) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
       } else {
         /* 比較の型エラー */
@@ -583,38 +1282,37 @@ do_compare(LL1LL_Value left, LL1LL_Value right, LVM_OpCode code)
       break;
     case LVM_NOT_EQUAL:
       /* 不等号 */
-      if (left.type == LL1LL_BOOLEAN_TYPE
-          && right.type == LL1LL_BOOLEAN_TYPE) {
+      if (get_type(left) == LL1LL_BOOLEAN_TYPE
+          && get_type(right) == LL1LL_BOOLEAN_TYPE) {
         /* 左辺がboolean, 右辺がboolean */
-        if (left.u.boolean_value != right.u.boolean_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_boolean_value(left) != get_boolean_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
-      } else if (left.type == LL1LL_INT_TYPE
-                 && right.type == LL1LL_INT_TYPE) {
+      } else if (get_type(left) == LL1LL_INT_TYPE
+                 && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がint, 右辺がint */
-        if (left.u.int_value != right.u.int_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_int_value(left) != get_int_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がdouble, 右辺がdouble */
-        if (fabs(left.u.double_value - right.u.double_value)
+        if (fabs(get_double_value(left) - get_double_value(right))
             >= DBL_EPSILON) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
       } else if (is_string(left) && is_string(right)) {
         /* 左辺がstring, 右辺がstring */
-        if (strcmp(get_string_value(left), 
-                   get_string_value(right)) != 0) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (equalString(get_object(left), get_object(right)) == LL1LL_FALSE) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
       } else {
         /* 比較の型エラー */
@@ -624,54 +1322,53 @@ do_compare(LL1LL_Value left, LL1LL_Value right, LVM_OpCode code)
       break;
     case LVM_GREATER:
       /* 大なり */
-      if (left.type == LL1LL_BOOLEAN_TYPE
-          && right.type == LL1LL_BOOLEAN_TYPE) {
+      if (get_type(left) == LL1LL_BOOLEAN_TYPE
+          && get_type(right) == LL1LL_BOOLEAN_TYPE) {
         /* 左辺がboolean, 右辺がboolean */
-        if (left.u.boolean_value == LL1LL_TRUE
-            && right.u.boolean_value == LL1LL_FALSE) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_boolean_value(left) == LL1LL_TRUE
+            && get_boolean_value(right) == LL1LL_FALSE) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
-      } else if (left.type == LL1LL_INT_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+      } else if (get_type(left) == LL1LL_INT_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がint, 右辺がdouble */
-        if ((double)left.u.int_value > right.u.double_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if ((double)get_int_value(left) > get_double_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_INT_TYPE) {
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がdouble, 右辺がint */
-        if (left.u.double_value > (double)right.u.int_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_double_value(left) > (double)get_int_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
-      } else if (left.type == LL1LL_INT_TYPE
-                 && right.type == LL1LL_INT_TYPE) {
+      } else if (get_type(left) == LL1LL_INT_TYPE
+                 && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がint, 右辺がint */
-        if (left.u.int_value > right.u.int_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_int_value(left) > get_int_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がdouble, 右辺がdouble */
-        if (left.u.double_value > right.u.double_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_double_value(left) > get_double_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
       } else if (is_string(left) && is_string(right)) {
         /* 左辺がstring, 右辺がstring */
-        if (strcmp(get_string_value(left), 
-                   get_string_value(right)) > 0) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (compareString(get_object(left), get_object(right)) > 0) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
       } else {
         /* 比較の型エラー */
@@ -681,45 +1378,44 @@ do_compare(LL1LL_Value left, LL1LL_Value right, LVM_OpCode code)
       break;
     case LVM_GREATER_EQUAL:
       /* 以上 */
-      if (left.type == LL1LL_INT_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+      if (get_type(left) == LL1LL_INT_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がint, 右辺がdouble */
-        if ((double)left.u.int_value >= right.u.double_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if ((double)get_int_value(left) >= get_double_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_INT_TYPE) {
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がdouble, 右辺がint */
-        if (left.u.double_value >= (double)right.u.int_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_double_value(left) >= (double)get_int_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
-      } else if (left.type == LL1LL_INT_TYPE
-                 && right.type == LL1LL_INT_TYPE) {
+      } else if (get_type(left) == LL1LL_INT_TYPE
+                 && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がint, 右辺がint */
-        if (left.u.int_value >= right.u.int_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_int_value(left) >= get_int_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がdouble, 右辺がdouble */
-        if (left.u.double_value >= right.u.double_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_double_value(left) >= get_double_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
       } else if (is_string(left) && is_string(right)) {
         /* 左辺がstring, 右辺がstring */
-        if (strcmp(get_string_value(left), 
-                   get_string_value(right)) >= 0) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (compareString(get_object(left), get_object(right)) >= 0) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
       } else {
         /* 比較の型エラー */
@@ -729,54 +1425,53 @@ do_compare(LL1LL_Value left, LL1LL_Value right, LVM_OpCode code)
       break;
     case LVM_LESSTHAN:
       /* 小なり */
-      if (left.type == LL1LL_BOOLEAN_TYPE
-          && right.type == LL1LL_BOOLEAN_TYPE) {
+      if (get_type(left) == LL1LL_BOOLEAN_TYPE
+          && get_type(right) == LL1LL_BOOLEAN_TYPE) {
         /* 左辺がboolean, 右辺がboolean */
-        if (left.u.boolean_value == LL1LL_FALSE
-            && right.u.boolean_value == LL1LL_TRUE) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_boolean_value(left) == LL1LL_FALSE
+            && get_boolean_value(right) == LL1LL_TRUE) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
-      } else if (left.type == LL1LL_INT_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+      } else if (get_type(left) == LL1LL_INT_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がint, 右辺がdouble */
-        if ((double)left.u.int_value < right.u.double_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if ((double)get_int_value(left) < get_double_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_INT_TYPE) {
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がdouble, 右辺がint */
-        if (left.u.double_value < (double)right.u.int_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_double_value(left) < (double)get_int_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
-      } else if (left.type == LL1LL_INT_TYPE
-                 && right.type == LL1LL_INT_TYPE) {
+      } else if (get_type(left) == LL1LL_INT_TYPE
+                 && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がint, 右辺がint */
-        if (left.u.int_value < right.u.int_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_int_value(left) < get_int_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がdouble, 右辺がdouble */
-        if (left.u.double_value < right.u.double_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_double_value(left) < get_double_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
       } else if (is_string(left) && is_string(right)) {
         /* 左辺がstring, 右辺がstring */
-        if (strcmp(get_string_value(left), 
-                   get_string_value(right)) < 0) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (compareString(get_object(left), get_object(right)) < 0) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
       } else {
         /* 比較の型エラー */
@@ -786,45 +1481,44 @@ do_compare(LL1LL_Value left, LL1LL_Value right, LVM_OpCode code)
       break;
     case LVM_LESSTHAN_EQUAL:
       /* 以下 */
-      if (left.type == LL1LL_INT_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+      if (get_type(left) == LL1LL_INT_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がint, 右辺がdouble */
-        if ((double)left.u.int_value <= right.u.double_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if ((double)get_int_value(left) <= get_double_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_INT_TYPE) {
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がdouble, 右辺がint */
-        if (left.u.double_value <= (double)right.u.int_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_double_value(left) <= (double)get_int_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
-      } else if (left.type == LL1LL_INT_TYPE
-                 && right.type == LL1LL_INT_TYPE) {
+      } else if (get_type(left) == LL1LL_INT_TYPE
+                 && get_type(right) == LL1LL_INT_TYPE) {
         /* 左辺がint, 右辺がint */
-        if (left.u.int_value <= right.u.int_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_int_value(left) <= get_int_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
-      } else if (left.type == LL1LL_DOUBLE_TYPE
-                 && right.type == LL1LL_DOUBLE_TYPE) {
+      } else if (get_type(left) == LL1LL_DOUBLE_TYPE
+                 && get_type(right) == LL1LL_DOUBLE_TYPE) {
         /* 左辺がdouble, 右辺がdouble */
-        if (left.u.double_value <= right.u.double_value) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (get_double_value(left) <= get_double_value(right)) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
       } else if (is_string(left) && is_string(right)) {
         /* 左辺がstring, 右辺がstring */
-        if (strcmp(get_string_value(left), 
-                   get_string_value(right)) <= 0) {
-          ret_value.u.boolean_value = LL1LL_TRUE;
+        if (compareString(get_object(left), get_object(right)) <= 0) {
+          set_boolean_value(ret_value, LL1LL_TRUE);
         } else {
-          ret_value.u.boolean_value = LL1LL_FALSE;
+          set_boolean_value(ret_value, LL1LL_FALSE);
         }
       } else {
         /* 比較の型エラー */
@@ -840,14 +1534,118 @@ do_compare(LL1LL_Value left, LL1LL_Value right, LVM_OpCode code)
 
 }
 
+/* 汎用の演算/比較命令genericを, オペランドleft, rightの型に特化した命令に変換する.
+ * 特化した命令が無い組み合わせでは, genericをそのまま返す */
+static LVM_OpCode
+quicken(LVM_OpCode generic, LL1LL_Value left, LL1LL_Value right)
+{
+  /* int同士 */
+  if (get_type(left) == LL1LL_INT_TYPE
+      && get_type(right) == LL1LL_INT_TYPE) {
+    switch (generic) {
+      case LVM_ADD:            return LVM_ADD_INT_INT;
+      case LVM_SUB:            return LVM_SUB_INT_INT;
+      case LVM_MUL:            return LVM_MUL_INT_INT;
+      case LVM_EQUAL:          return LVM_EQ_INT_INT;
+      case LVM_NOT_EQUAL:      return LVM_NE_INT_INT;
+      case LVM_GREATER:        return LVM_GT_INT_INT;
+      case LVM_GREATER_EQUAL:  return LVM_GE_INT_INT;
+      case LVM_LESSTHAN:       return LVM_LT_INT_INT;
+      case LVM_LESSTHAN_EQUAL: return LVM_LE_INT_INT;
+      default:                 return generic;
+    }
+  }
+
+  /* double同士. 等号/不等号は誤差を考慮するので汎用命令のまま */
+  if (get_type(left) == LL1LL_DOUBLE_TYPE
+      && get_type(right) == LL1LL_DOUBLE_TYPE) {
+    switch (generic) {
+      case LVM_ADD:            return LVM_ADD_DBL_DBL;
+      case LVM_SUB:            return LVM_SUB_DBL_DBL;
+      case LVM_MUL:            return LVM_MUL_DBL_DBL;
+      case LVM_GREATER:        return LVM_GT_DBL_DBL;
+      case LVM_GREATER_EQUAL:  return LVM_GE_DBL_DBL;
+      case LVM_LESSTHAN:       return LVM_LT_DBL_DBL;
+      case LVM_LESSTHAN_EQUAL: return LVM_LE_DBL_DBL;
+      default:                 return generic;
+    }
+  }
+
+  /* string同士の連結 */
+  if (generic == LVM_ADD
+      && is_string(left) && is_string(right)) {
+    return LVM_CONCAT_STR_STR;
+  }
+
+  return generic;
+}
+
+/* スタックをneed語以上に拡張する. 拡張は倍々で行い, 回数を抑える */
+static void growStack(int need)
+{
+  int new_size = (stack_size == 0) ? INIT_EXE_STACK_SIZE : stack_size;
+
+  if (need <= stack_size) {
+    return;
+  }
+  while (new_size < need) {
+    new_size *= 2;
+  }
+  stack      = (LL1LL_Value *)MEM_realloc(stack, sizeof(LL1LL_Value) * new_size);
+  stack_size = new_size;
+}
+
+/* 比較分岐命令opcode(LVM_JLT〜LVM_JNE)で, left, rightを比較した時にジャンプするか.
+ * int同士は直接比較する. それ以外は融合前の比較命令の否定で判定し, 融合前と同じ分岐になるようにする */
+static int
+compare_jump(LVM_OpCode opcode, LL1LL_Value left, LL1LL_Value right)
+{
+  if (get_type(left) == LL1LL_INT_TYPE
+      && get_type(right) == LL1LL_INT_TYPE) {
+    switch (opcode) {
+      case LVM_JLT: return get_int_value(left) <  get_int_value(right);
+      case LVM_JLE: return get_int_value(left) <= get_int_value(right);
+      case LVM_JGT: return get_int_value(left) >  get_int_value(right);
+      case LVM_JGE: return get_int_value(left) >= get_int_value(right);
+      case LVM_JEQ: return get_int_value(left) == get_int_value(right);
+      case LVM_JNE: return get_int_value(left) != get_int_value(right);
+      default:      break;
+    }
+  }
+  if ((opcode == LVM_JEQ || opcode == LVM_JNE)
+      && is_string(left) && is_string(right)) {
+    /* switchのcaseの判定. 重複を除いた文字列同士ならポインタの比較で済む */
+    return (equalString(get_object(left), get_object(right)) == LL1LL_TRUE) == (opcode == LVM_JEQ);
+  }
+
+  switch (opcode) {
+    case LVM_JLT:
+      return get_boolean_value(do_compare(left, right, LVM_GREATER_EQUAL)) == LL1LL_FALSE;
+    case LVM_JLE:
+      return get_boolean_value(do_compare(left, right, LVM_GREATER)) == LL1LL_FALSE;
+    case LVM_JGT:
+      return get_boolean_value(do_compare(left, right, LVM_LESSTHAN_EQUAL)) == LL1LL_FALSE;
+    case LVM_JGE:
+      return get_boolean_value(do_compare(left, right, LVM_LESSTHAN)) == LL1LL_FALSE;
+    case LVM_JEQ:
+      return get_boolean_value(do_compare(left, right, LVM_EQUAL)) == LL1LL_TRUE;
+    case LVM_JNE:
+      return get_boolean_value(do_compare(left, right, LVM_EQUAL)) == LL1LL_FALSE;
+    default:
+      fprintf(stderr, "Error! Invailed compare jump opcode \n");
+      exit(EXIT_FAILURE);
+  }
+}
+
 /* ストリームへの出力 */
 static LL1LL_Value do_put_stream(LL1LL_Value left, LL1LL_Value right)
 {
   /* 返り値は, 書き込みステータスを取る */
   LL1LL_Value ret_value;
+  size_t length;  /* 書き込む文字列の長さ */
 
   /* 左辺がストリーム型で無いならばエラー */
-  if (left.type != LL1LL_STREAM_TYPE) {
+  if (get_type(left) != LL1LL_STREAM_TYPE) {
     fprintf(stderr, "Error! left hand of << isn't streamor string type \n");
     exit(EXIT_FAILURE);
   }
@@ -858,12 +1656,14 @@ static LL1LL_Value do_put_stream(LL1LL_Value left, LL1LL_Value right)
     exit(EXIT_FAILURE);
   }
 
-  /* fputsを使って書き込む.
-   * TODO:fputsでいいのか? -> 今のところは良さそう */
-  ret_value.type = LL1LL_INT_TYPE;
-  /* 結果はfputs(書き込み)の戻り値 */
-  ret_value.u.int_value
-    = fputs(get_string_value(right), left.u.stream_value);
+  /* 長さが分かっているので, fwriteでまとめて書き込む.
+   * 結果はfputsと同じく, 成功すれば非負(書き込んだ長さ), 失敗すればEOF */
+  length = get_string_length(right);
+  if (fwrite(get_string_value(right), 1, length, get_stream_value(left)) == length) {
+    set_int_value(ret_value, (int)length);
+  } else {
+    set_int_value(ret_value, EOF);
+  }
 
   return ret_value;
 }
@@ -873,41 +1673,42 @@ static void printStackElement(int stack_p)
 {
   /* スタックの値と, 型の取得 */
   LL1LL_Value val = stack[stack_p];
-  LL1LL_TypeKind type = val.type;
+  LL1LL_TypeKind type = get_type(val);
 
   /* 型で場合分けして印字 */
   switch (type) {
     case LL1LL_INT_TYPE:
-      printf("%4d : int_value : %d", stack_p, val.u.int_value);
+      printf("%4d : int_value : %d", stack_p, get_int_value(val));
       break;
     case LL1LL_DOUBLE_TYPE:
-      printf("%4d : double_value : %f", stack_p, val.u.double_value);
+      printf("%4d : double_value : %f", stack_p, get_double_value(val));
       break;
     case LL1LL_BOOLEAN_TYPE:
-      if (val.u.boolean_value == LL1LL_TRUE) {
+      if (get_boolean_value(val) == LL1LL_TRUE) {
         printf("%4d : boolean_value : true", stack_p);
       } else {
         printf("%4d : boolean_value : false", stack_p);
       }
       break;
     case LL1LL_STREAM_TYPE:
-      if (val.u.stream_value == stdin) {
+      if (get_stream_value(val) == stdin) {
         printf("%4d : stream_value : stdin", stack_p);
-      } else if (val.u.stream_value == stdout) {
+      } else if (get_stream_value(val) == stdout) {
         printf("%4d : stream_value : stdout", stack_p);
-      } else if (val.u.stream_value == stderr) {
+      } else if (get_stream_value(val) == stderr) {
         printf("%4d : stream_value : stderr", stack_p);
       } else {
-        printf("%4d : stream_value(file pointer) : %p", stack_p, val.u.stream_value);
+        printf("%4d : stream_value(file pointer) : %p", stack_p, get_stream_value(val));
       }
       break;
     case LL1LL_OBJECT_TYPE:
-      switch (val.u.object->type) {
+      switch (get_object(val)->type) {
         case ARRAY_OBJECT:
           /* TODO */
           break;
+        case ROPE_OBJECT:    /* FALLTHRU */
         case STRING_OBJECT:
-          printf("%4d : string_object : \"%s\"", stack_p, val.u.object->u.str.string_value);
+          printf("%4d : string_object : \"%s\"", stack_p, get_string_value(val));
           break;
         default:
           break;
@@ -11,8 +11,16 @@
 #include "heap.h"
 
 /* FIXME:こいつも可変にしましょう */
-#define MAX_EXE_STACK_SIZE (3000)     /* 実行時スタックの最大サイズ */
+#define INIT_EXE_STACK_SIZE (3000)    /* 実行時スタックの初期サイズ. 足りなければ倍々で拡張する */
 #define RUNTIME_STR_BUF_SIZE (200)    /* 実行時に確保しておく文字列バッファの長さ */
+#define FORMAT_INT_SIZE      (12)     /* intを10進にした文字列(符号, 終端文字付き)の最大の長さ */
+#define FORMAT_DOUBLE_SIZE   (24)     /* 1e13未満の実数を"%f"の書式にした文字列(符号, 終端文字付き)の最大の長さ */
+
+/* GCC/Clangでは, ラベルのアドレス(computed goto)を使ったスレッデッドコードで命令を実行する.
+ * LVM_NO_THREADED_CODEを定義すると, 移植性のあるswitch文による実行になる */
+#if defined(__GNUC__) && !defined(LVM_NO_THREADED_CODE)
+#define LVM_THREADED_CODE
+#endif
 
 int getStackTop(void);              /* 現在のスタックトップを得る */
 LL1LL_Value *getStackPointer(void); /* 現在のスタックを指すポインタを得る */
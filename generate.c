@@ -2,8 +2,24 @@
 
 static LVM_Instruction code[MAX_CODE_SIZE]; /* 命令コードの配列 */
 static int current_code_size = -1;          /* 現在のコードサイズ */
+static LL1LL_Value *constant_pool = NULL;   /* 定数表:即値の実体 */
+static int constant_pool_size  = 0;         /* 定数表の要素数 */
+static int constant_pool_alloc = 0;         /* 定数表の割り当てサイズ */
 
 static void checkCodeSize(void);            /* コードサイズの確認と, コードサイズ増加 TODO:ここでrealloc */
+static int peepholePass(void);              /* 覗き穴最適化を1回行い, 融合した命令の数を返す */
+static int addConstant(LL1LL_Value value);  /* 定数表に値を登録し, インデックスを返す */
+static int isSameConstant(LL1LL_Value a, LL1LL_Value b); /* 二つの定数が同じ値か */
+static int isSameAddress(LVM_RelAddr a, LVM_RelAddr b); /* 二つのアドレスが同じ変数を指しているか */
+static int isLocalJumpCode(LVM_OpCode opcode);  /* 比較分岐命令の変数版か */
+static int isImmediateJumpCode(LVM_OpCode opcode); /* 比較分岐命令の即値版か */
+static int codeWidth(LVM_OpCode opcode);        /* 追加オペランドを含めた命令の語数 */
+static int stackEffect(int pc);                 /* pcの命令を実行した時のスタックトップの増減 */
+static int frameStackNeed(int entry_pc);        /* entry_pcから始まるフレームの最大スタック必要量 */
+static void printConstant(LL1LL_Value value);   /* 定数の表示 */
+static LVM_OpCode compareJumpCode(LVM_OpCode compare, LVM_OpCode jump); /* 比較命令と条件ジャンプを融合した命令を得る */
+static LVM_OpCode immediateJumpCode(LVM_OpCode opcode); /* 比較分岐命令の即値版を得る */
+static LVM_OpCode localJumpCode(LVM_OpCode opcode);     /* 比較分岐命令の変数版を得る */
 
 /* 次の命令語のアドレス(pc)を返す */
 int nextCode(void)
@@ -11,24 +27,98 @@ int nextCode(void)
   return current_code_size + 1;
 }
 
-/* オペランドに値(即値)をとる命令の生成 */
+/* pcの命令が文字列の即値のプッシュか */
+int isStringImmediate(int pc)
+{
+  return code[pc].opcode == LVM_PUSH_IMMEDIATE
+         && is_string(constant_pool[code[pc].u.const_index]);
+}
+
+/* オペランドに値(即値)をとる命令の生成. 値は定数表に置き, オペランドはそのインデックス */
 int genCodeValue(LVM_OpCode opcode, LL1LL_Value value)
 {
   checkCodeSize();                          /* コードサイズ検査 */
-  code[current_code_size].opcode  = opcode; /* オペコード */
-  code[current_code_size].u.value = value;  /* オペランド */
+  code[current_code_size].opcode        = opcode;             /* オペコード */
+  code[current_code_size].u.const_index = addConstant(value); /* オペランド */
   return current_code_size;                 /* 現在のコードサイズを返す */
 }
 
-/* オペランドに（変数）アドレスを取る命令の生成 */
+/* オペランドに（変数）アドレスを取る命令の生成.
+ * 変数のプッシュ・ポップは, トップレベルと現在の関数の変数ならディスプレイを引かない版にする */
 int genCodeTable(LVM_OpCode opcode, int table_index)
 {
+  RelAddr rel_addr = getVarRelAddr(table_index);  /* アドレスの取得 */
+
+  if (rel_addr.block_level == 0) {
+    if (opcode == LVM_PUSH_VALUE) {
+      opcode = LVM_PUSH_GLOBAL;
+    } else if (opcode == LVM_POP_VARIABLE) {
+      opcode = LVM_POP_GLOBAL;
+    }
+  } else if (rel_addr.block_level == getFuncLevel()) {
+    if (opcode == LVM_PUSH_VALUE) {
+      opcode = LVM_PUSH_LOCAL;
+    } else if (opcode == LVM_POP_VARIABLE) {
+      opcode = LVM_POP_LOCAL;
+    }
+  }
+
   checkCodeSize();
-  code[current_code_size].opcode    = opcode;
-  code[current_code_size].u.address = getVarRelAddr(table_index); /* アドレスの取得 */
+  code[current_code_size].opcode                = opcode;
+  code[current_code_size].u.address.block_level = rel_addr.block_level;
+  code[current_code_size].u.address.address     = rel_addr.address;
   return current_code_size;
 }
 
+/* 定数表に値を登録し, そのインデックスを返す. 同じ値が既にあれば共有する */
+static int addConstant(LL1LL_Value value)
+{
+  int i;
+
+  for (i = 0; i < constant_pool_size; i++) {
+    if (isSameConstant(constant_pool[i], value)) {
+      return i;
+    }
+  }
+
+  /* 足りなければ倍々で拡張 */
+  if (constant_pool_size >= constant_pool_alloc) {
+    constant_pool_alloc = (constant_pool_alloc == 0) ? 16 : constant_pool_alloc * 2;
+    constant_pool = (LL1LL_Value *)MEM_realloc(constant_pool,
+                                               sizeof(LL1LL_Value) * constant_pool_alloc);
+  }
+  constant_pool[constant_pool_size] = value;
+  return constant_pool_size++;
+}
+
+/* 二つの定数が同じ値か. doubleは0.0と-0.0を区別するためbit列で比較する */
+static int isSameConstant(LL1LL_Value a, LL1LL_Value b)
+{
+  double da, db;
+
+  if (get_type(a) != get_type(b)) {
+    return 0;
+  }
+  switch (get_type(a)) {
+    case LL1LL_INT_TYPE:
+      return get_int_value(a) == get_int_value(b);
+    case LL1LL_DOUBLE_TYPE:
+      da = get_double_value(a);
+      db = get_double_value(b);
+      return memcmp(&da, &db, sizeof(double)) == 0;
+    case LL1LL_BOOLEAN_TYPE:
+      return get_boolean_value(a) == get_boolean_value(b);
+    case LL1LL_OBJECT_TYPE:
+      return get_object(a) == get_object(b);
+    case LL1LL_STREAM_TYPE:
+      return get_stream_value(a) == get_stream_value(b);
+    case LL1LL_NULL_TYPE:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
 /* 演算命令の生成 */
 int genCodeCalc(LVM_OpCode opcode)
 {
@@ -37,6 +127,15 @@ int genCodeCalc(LVM_OpCode opcode)
   return current_code_size;
 }
 
+/* 文字列連結の連鎖の命令の生成. オペランドは連結する値の数 */
+int genCodeConcat(int concat_count)
+{
+  checkCodeSize();
+  code[current_code_size].opcode         = LVM_CONCAT_N;
+  code[current_code_size].u.concat_count = concat_count;
+  return current_code_size;
+}
+
 /* return命令の生成 */
 int genCodeReturn(void)
 {
@@ -50,11 +149,31 @@ int genCodeReturn(void)
   /* オペランドのブロックレベルやパラメタ数は, table.hからの情報を使う */
   checkCodeSize();
   code[current_code_size].opcode = LVM_RETURN;
-  code[current_code_size].u.address.block_level = getBlockLevel();
+  code[current_code_size].u.address.block_level = getFuncLevel();
   code[current_code_size].u.address.address     = getCurrentNumParams();
   return current_code_size;
 }
 
+/* 末尾呼び出しの生成. return文の式の直後に呼ばれる.
+ * 式が関数呼び出しで終わっていれば, その呼び出しを現在のフレームを使い回すLVM_TAIL_INVOKEに置き換え, 1を返す.
+ * この場合は戻りも呼び先のreturn命令が行うので, return命令は不要.
+ * 呼び先が現在の関数と同じレベルでないとディスプレイを戻せないので, その時とトップレベルでは置き換えない */
+int genCodeTailInvoke(void)
+{
+  if (current_code_size < 0
+      || code[current_code_size].opcode != LVM_INVOKE
+      || getFuncLevel() == 0
+      || code[current_code_size].u.address.block_level + 1 != getFuncLevel()) {
+    return 0;
+  }
+
+  code[current_code_size].opcode = LVM_TAIL_INVOKE;
+  checkCodeSize();
+  code[current_code_size].opcode     = LVM_OPERAND;
+  code[current_code_size].u.move_top = getCurrentNumParams(); /* 現在の関数の仮引数の数 */
+  return 1;
+}
+
 /* jump系命令の生成 */
 int genCodeJump(LVM_OpCode opcode, int jump_pc)
 {
@@ -64,6 +183,157 @@ int genCodeJump(LVM_OpCode opcode, int jump_pc)
   return current_code_size;
 }
 
+/* 条件ジャンプ(LVM_JUMP_IF_TRUE/FALSE)命令の生成.
+ * 条件式の直後に呼ばれ, 直前の命令が比較命令ならば比較分岐命令に置き換える.
+ * 返り値はバックパッチ対象のpc */
+int genCodeCondJump(LVM_OpCode opcode, int jump_pc)
+{
+  LVM_OpCode fused = LVM_NOP;
+
+  if (current_code_size >= 0) {
+    fused = compareJumpCode(code[current_code_size].opcode, opcode);
+  }
+  if (fused == LVM_NOP) {
+    return genCodeJump(opcode, jump_pc);
+  }
+
+  /* 比較命令をその場で比較分岐命令に書き換える */
+  code[current_code_size].opcode    = fused;
+  code[current_code_size].u.jump_pc = jump_pc;
+  return current_code_size;
+}
+
+/* 比較命令compareの直後の条件ジャンプjumpを融合した比較分岐命令を返す. 融合できなければLVM_NOP.
+ * 偽でジャンプする場合は全ての比較を融合できる.
+ * 真でジャンプする場合は, 否定が厳密に一致する等号/不等号のみ融合する */
+static LVM_OpCode compareJumpCode(LVM_OpCode compare, LVM_OpCode jump)
+{
+  if (jump == LVM_JUMP_IF_FALSE) {
+    switch (compare) {
+      case LVM_LESSTHAN:       return LVM_JGE;
+      case LVM_LESSTHAN_EQUAL: return LVM_JGT;
+      case LVM_GREATER:        return LVM_JLE;
+      case LVM_GREATER_EQUAL:  return LVM_JLT;
+      case LVM_EQUAL:          return LVM_JNE;
+      case LVM_NOT_EQUAL:      return LVM_JEQ;
+      default:                 return LVM_NOP;
+    }
+  } else if (jump == LVM_JUMP_IF_TRUE) {
+    switch (compare) {
+      case LVM_EQUAL:          return LVM_JEQ;
+      case LVM_NOT_EQUAL:      return LVM_JNE;
+      default:                 return LVM_NOP;
+    }
+  }
+  return LVM_NOP;
+}
+
+/* 比較分岐命令の即値版を得る. 比較分岐命令でなければLVM_NOP */
+static LVM_OpCode immediateJumpCode(LVM_OpCode opcode)
+{
+  switch (opcode) {
+    case LVM_JLT: return LVM_JLT_IMM;
+    case LVM_JLE: return LVM_JLE_IMM;
+    case LVM_JGT: return LVM_JGT_IMM;
+    case LVM_JGE: return LVM_JGE_IMM;
+    case LVM_JEQ: return LVM_JEQ_IMM;
+    case LVM_JNE: return LVM_JNE_IMM;
+    default:      return LVM_NOP;
+  }
+}
+
+/* 比較分岐命令の変数版を得る. 比較分岐命令でなければLVM_NOP */
+static LVM_OpCode localJumpCode(LVM_OpCode opcode)
+{
+  switch (opcode) {
+    case LVM_JLT: return LVM_JLT_LOCAL;
+    case LVM_JLE: return LVM_JLE_LOCAL;
+    case LVM_JGT: return LVM_JGT_LOCAL;
+    case LVM_JGE: return LVM_JGE_LOCAL;
+    case LVM_JEQ: return LVM_JEQ_LOCAL;
+    case LVM_JNE: return LVM_JNE_LOCAL;
+    default:      return LVM_NOP;
+  }
+}
+
+/* 比較分岐命令の変数版か(追加オペランドがアドレスになる) */
+static int isLocalJumpCode(LVM_OpCode opcode)
+{
+  switch (opcode) {
+    case LVM_JLT_LOCAL: case LVM_JLE_LOCAL: case LVM_JGT_LOCAL:
+    case LVM_JGE_LOCAL: case LVM_JEQ_LOCAL: case LVM_JNE_LOCAL:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* 比較分岐命令の即値版か(追加オペランドが定数表インデックスになる) */
+static int isImmediateJumpCode(LVM_OpCode opcode)
+{
+  switch (opcode) {
+    case LVM_JLT_IMM: case LVM_JLE_IMM: case LVM_JGT_IMM:
+    case LVM_JGE_IMM: case LVM_JEQ_IMM: case LVM_JNE_IMM:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* オペランドにジャンプ先pcをとる命令か */
+int isJumpCode(LVM_OpCode opcode)
+{
+  switch (opcode) {
+    case LVM_JUMP:          /* FALLTHRU */
+    case LVM_JUMP_IF_TRUE:  /* FALLTHRU */
+    case LVM_JUMP_IF_FALSE: /* FALLTHRU */
+    case LVM_JLT:       case LVM_JLE:       case LVM_JGT:
+    case LVM_JGE:       case LVM_JEQ:       case LVM_JNE:
+    case LVM_JLT_IMM:   case LVM_JLE_IMM:   case LVM_JGT_IMM:
+    case LVM_JGE_IMM:   case LVM_JEQ_IMM:   case LVM_JNE_IMM:
+    case LVM_JLT_LOCAL: case LVM_JLE_LOCAL: case LVM_JGT_LOCAL:
+    case LVM_JGE_LOCAL: case LVM_JEQ_LOCAL: case LVM_JNE_LOCAL:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* 変数をプッシュする命令か */
+int isPushVariableCode(LVM_OpCode opcode)
+{
+  return (opcode == LVM_PUSH_VALUE
+          || opcode == LVM_PUSH_LOCAL
+          || opcode == LVM_PUSH_GLOBAL);
+}
+
+/* 変数にポップする命令か */
+int isPopVariableCode(LVM_OpCode opcode)
+{
+  return (opcode == LVM_POP_VARIABLE
+          || opcode == LVM_POP_LOCAL
+          || opcode == LVM_POP_GLOBAL);
+}
+
+/* 関数(トップレベル)の入口命令の生成.
+ * ローカル変数の量はchangeMoveTopで, フレームの最大スタック必要量はcomputeStackNeedで後からセットする */
+int genCodeEnter(int num_params)
+{
+  int enter_pc;
+
+  checkCodeSize();
+  enter_pc = current_code_size;
+  code[enter_pc].opcode     = LVM_ENTER;
+  code[enter_pc].u.move_top = 0;          /* ローカル変数の量 */
+  checkCodeSize();
+  code[current_code_size].opcode     = LVM_OPERAND;
+  code[current_code_size].u.move_top = 0; /* フレームの最大スタック必要量 */
+  checkCodeSize();
+  code[current_code_size].opcode     = LVM_OPERAND;
+  code[current_code_size].u.move_top = num_params; /* 仮引数の数 */
+  return enter_pc;
+}
+
 /* トップ移動命令の生成 */
 int genCodeMove(LVM_OpCode opcode, int move_top)
 {
@@ -106,6 +376,348 @@ void changeMoveTop(int pc, int move_top)
   code[pc].u.move_top = move_top;
 }
 
+/* 各フレーム(関数とトップレベル)の最大スタック必要量を求め, 入口命令の追加オペランドにセットする.
+ * 実行時はLVM_INVOKEでこの量だけ確認すれば, フレーム内ではスタック溢れが起こらない.
+ * 覗き穴最適化の後, 命令列が確定してから呼ぶ */
+void computeStackNeed(void)
+{
+  int pc;
+
+  for (pc = 0; pc <= current_code_size; pc += codeWidth(code[pc].opcode)) {
+    if (code[pc].opcode == LVM_ENTER) {
+      code[pc+1].u.move_top = frameStackNeed(pc);
+    }
+  }
+}
+
+/* entry_pcから始まるフレームの最大スタック必要量(フレーム先頭からの語数).
+ * 制御の流れに沿って各pcでのスタックの深さを求め, その最大をとる.
+ * 合流点での深さは経路によらず一致するはずなので, 食い違えばコード生成の誤りとして止める.
+ * (ブロックの局所変数は関数フレームにあり, 飛び越して困る後始末はない.
+ *  ループ内で積まれたままなのはswitch文の判定式だけで, break/continueはそれを捨ててから飛ぶ) */
+static int frameStackNeed(int entry_pc)
+{
+  int *depth;      /* 各pcでの深さ. 未到達は-1 */
+  int *work;       /* 未処理のpcの作業スタック */
+  char *queued;    /* 作業スタックに積まれているか */
+  int n_work = 0;
+  int pc, d, next, i;
+  int need = 0;
+  int succ[2], n_succ;
+
+  depth  = (int *)MEM_malloc(sizeof(int) * (current_code_size + 1));
+  work   = (int *)MEM_malloc(sizeof(int) * (current_code_size + 1));
+  queued = (char *)MEM_malloc(sizeof(char) * (current_code_size + 1));
+  for (pc = 0; pc <= current_code_size; pc++) {
+    depth[pc]  = -1;
+    queued[pc] = 0;
+  }
+
+  depth[entry_pc]  = 0;
+  queued[entry_pc] = 1;
+  work[n_work++]   = entry_pc;
+  while (n_work > 0) {
+    pc = work[--n_work];
+    queued[pc] = 0;
+    d = depth[pc] + stackEffect(pc);
+    if (d < 0) {
+      fprintf(stderr, "Error! Stack underflow in stack analysis at pc:%d \n", pc);
+      exit(1);
+    }
+    if (d > need) {
+      need = d;
+    }
+
+    /* 次に実行され得る命令 */
+    n_succ = 0;
+    next   = pc + codeWidth(code[pc].opcode);
+    switch (code[pc].opcode) {
+      case LVM_RETURN:      /* FALLTHRU */
+      case LVM_TAIL_INVOKE: /* FALLTHRU */
+      case LVM_HALT:
+        break;
+      case LVM_JUMP:
+        succ[n_succ++] = code[pc].u.jump_pc;
+        break;
+      default:
+        succ[n_succ++] = next;
+        if (isJumpCode(code[pc].opcode)) {
+          succ[n_succ++] = code[pc].u.jump_pc;
+        }
+        break;
+    }
+    for (i = 0; i < n_succ; i++) {
+      if (succ[i] > current_code_size || depth[succ[i]] == d) {
+        continue;
+      }
+      if (depth[succ[i]] != -1) {
+        fprintf(stderr, "Error! Unbalanced stack depth at pc:%d (%d and %d) \n",
+                succ[i], depth[succ[i]], d);
+        exit(1);
+      }
+      depth[succ[i]] = d;
+      if (!queued[succ[i]]) {
+        queued[succ[i]] = 1;
+        work[n_work++]  = succ[i];
+      }
+    }
+  }
+
+  MEM_free(queued);
+  MEM_free(work);
+  MEM_free(depth);
+  return need;
+}
+
+/* 追加オペランドを含めた命令の語数 */
+static int codeWidth(LVM_OpCode opcode)
+{
+  switch (opcode) {
+    case LVM_ENTER:
+      return 3;
+    case LVM_TAIL_INVOKE:   /* FALLTHRU */
+    case LVM_ADD_LOCAL_IMM: /* FALLTHRU */
+    case LVM_SUB_LOCAL_IMM:
+      return 2;
+    default:
+      if (isImmediateJumpCode(opcode) || isLocalJumpCode(opcode)) {
+        return 2;
+      }
+      return 1;
+  }
+}
+
+/* pcの命令を実行した時のスタックトップの増減. 関数呼び出しは戻ってきた後の増減 */
+static int stackEffect(int pc)
+{
+  switch (code[pc].opcode) {
+    case LVM_NOP:              /* FALLTHRU */
+    case LVM_JUMP:             /* FALLTHRU */
+    case LVM_RETURN:           /* FALLTHRU */
+    case LVM_TAIL_INVOKE:      /* FALLTHRU */
+    case LVM_HALT:             /* FALLTHRU */
+    case LVM_MINUS:            /* FALLTHRU */
+    case LVM_LOGICAL_NOT:      /* FALLTHRU */
+    case LVM_INCREMENT:        /* FALLTHRU */
+    case LVM_DECREMENT:        /* FALLTHRU */
+    case LVM_INC_LOCAL:        /* FALLTHRU */
+    case LVM_DEC_LOCAL:        /* FALLTHRU */
+    case LVM_PUSH_FROM_STREAM:
+      return 0;
+    case LVM_MOVE_STACK_P:     /* FALLTHRU */
+    case LVM_ENTER:
+      return code[pc].u.move_top;
+    case LVM_PUSH_IMMEDIATE:   /* FALLTHRU */
+    case LVM_PUSH_VALUE:       /* FALLTHRU */
+    case LVM_PUSH_LOCAL:       /* FALLTHRU */
+    case LVM_PUSH_GLOBAL:      /* FALLTHRU */
+    case LVM_DUPLICATE:        /* FALLTHRU */
+    case LVM_ADD_LOCAL_IMM:    /* FALLTHRU */
+    case LVM_SUB_LOCAL_IMM:
+      return 1;
+    case LVM_POP_VARIABLE:     /* FALLTHRU */
+    case LVM_POP_LOCAL:        /* FALLTHRU */
+    case LVM_POP_GLOBAL:       /* FALLTHRU */
+    case LVM_POP:              /* FALLTHRU */
+    case LVM_JUMP_IF_TRUE:     /* FALLTHRU */
+    case LVM_JUMP_IF_FALSE:    /* FALLTHRU */
+    case LVM_ADD:              /* FALLTHRU */
+    case LVM_SUB:              /* FALLTHRU */
+    case LVM_MUL:              /* FALLTHRU */
+    case LVM_DIV:              /* FALLTHRU */
+    case LVM_MOD:              /* FALLTHRU */
+    case LVM_POW:              /* FALLTHRU */
+    case LVM_LOGICAL_AND:      /* FALLTHRU */
+    case LVM_LOGICAL_OR:       /* FALLTHRU */
+    case LVM_EQUAL:            /* FALLTHRU */
+    case LVM_NOT_EQUAL:        /* FALLTHRU */
+    case LVM_GREATER:          /* FALLTHRU */
+    case LVM_GREATER_EQUAL:    /* FALLTHRU */
+    case LVM_LESSTHAN:         /* FALLTHRU */
+    case LVM_LESSTHAN_EQUAL:   /* FALLTHRU */
+    case LVM_POP_TO_STREAM:
+      return -1;
+    case LVM_JLT: case LVM_JLE: case LVM_JGT:
+    case LVM_JGE: case LVM_JEQ: case LVM_JNE:
+      return -2;
+    case LVM_CONCAT_N:
+      /* 連結する値が結果の1つに置き換わる */
+      return 1 - code[pc].u.concat_count;
+    case LVM_INVOKE:
+      /* 戻り値が1つ積まれ, 実引数の分だけ下がる. 仮引数の数は呼び先の入口命令にある */
+      return 1 - code[code[pc].u.address.address + 2].u.move_top;
+    default:
+      if (isImmediateJumpCode(code[pc].opcode) || isLocalJumpCode(code[pc].opcode)) {
+        return -1;
+      }
+      fprintf(stderr, "Error! Unknown opcode in stack analysis at pc:%d \n", pc);
+      exit(1);
+  }
+}
+
+/* 二つのアドレスが同じ変数を指しているか */
+static int isSameAddress(LVM_RelAddr a, LVM_RelAddr b)
+{
+  return (a.block_level == b.block_level
+          && a.address == b.address);
+}
+
+/* 覗き穴最適化.
+ * genCode*で生成し終えた命令列を走査して, よく出る命令の並びをスーパー命令に融合する.
+ * 融合できなくなるまで繰り返す */
+void peepholeOptimize(void)
+{
+  while (peepholePass() > 0)
+    ;
+}
+
+/* 覗き穴最適化の1パス.
+ * 命令列を前から詰め直しながら融合し, 最後にジャンプ先を新しいpcに付け替える.
+ * 並びの途中の命令がジャンプ先になっている場合は融合しない */
+static int peepholePass(void)
+{
+  int pc, out;              /* 読み出し位置と, 書き込み位置 */
+  int fused = 0;            /* 融合した命令の数 */
+  int *new_pc;              /* 古いpcから新しいpcへの対応表 */
+  char *is_target;          /* ジャンプ先になっているか */
+  LVM_Instruction c0, c1, c2; /* 並びの命令 */
+
+  /* 古いpcの範囲は, 命令列の次(バックパッチで飛び先になり得る)まで */
+  new_pc    = (int *)MEM_malloc(sizeof(int) * (current_code_size + 2));
+  is_target = (char *)MEM_malloc(sizeof(char) * (current_code_size + 2));
+  memset(is_target, 0, sizeof(char) * (current_code_size + 2));
+
+  /* ジャンプ先に印を付ける */
+  for (pc = 0; pc <= current_code_size; pc++) {
+    if (isJumpCode(code[pc].opcode)) {
+      is_target[code[pc].u.jump_pc] = 1;
+    } else if (code[pc].opcode == LVM_INVOKE || code[pc].opcode == LVM_TAIL_INVOKE) {
+      is_target[code[pc].u.address.address] = 1;
+    }
+  }
+
+  /* 詰め直しながら融合. out <= pcなので, 並びは読み出してから書き込む */
+  pc = out = 0;
+  while (pc <= current_code_size) {
+    new_pc[pc] = out;
+    c0 = code[pc];
+    c1 = (pc + 1 <= current_code_size) ? code[pc+1] : c0;
+    c2 = (pc + 2 <= current_code_size) ? code[pc+2] : c0;
+
+    /* 2命令の並び */
+    if (pc + 1 <= current_code_size && !is_target[pc+1]) {
+      /* push_value; pop => 何もしない(代入式の左辺値の読み捨て) */
+      if (isPushVariableCode(c0.opcode) && c1.opcode == LVM_POP) {
+        new_pc[pc+1] = out;
+        pc += 2;
+        fused++;
+        continue;
+      }
+      /* push_immediate v; jxx => jxx_imm v */
+      if (c0.opcode == LVM_PUSH_IMMEDIATE
+          && immediateJumpCode(c1.opcode) != LVM_NOP) {
+        code[out].opcode    = immediateJumpCode(c1.opcode);
+        code[out].u.jump_pc = c1.u.jump_pc;
+        out++;
+        code[out].opcode    = LVM_OPERAND;   /* 比較する即値 */
+        code[out].u.const_index = c0.u.const_index;
+        out++;
+        new_pc[pc+1] = out - 2;
+        pc += 2;
+        fused++;
+        continue;
+      }
+      /* push_value a; jxx => jxx_local a */
+      if (isPushVariableCode(c0.opcode)
+          && localJumpCode(c1.opcode) != LVM_NOP) {
+        code[out].opcode    = localJumpCode(c1.opcode);
+        code[out].u.jump_pc = c1.u.jump_pc;
+        out++;
+        code[out].opcode    = LVM_OPERAND;   /* 比較する変数のアドレス */
+        code[out].u.address = c0.u.address;
+        out++;
+        new_pc[pc+1] = out - 2;
+        pc += 2;
+        fused++;
+        continue;
+      }
+    }
+
+    /* 3命令の並び */
+    if (pc + 2 <= current_code_size
+        && !is_target[pc+1] && !is_target[pc+2]) {
+      /* duplicate; pop_variable; pop => pop_variable(代入文) */
+      if (c0.opcode == LVM_DUPLICATE
+          && isPopVariableCode(c1.opcode)
+          && c2.opcode == LVM_POP) {
+        code[out++] = c1;
+        new_pc[pc+1] = new_pc[pc+2] = out - 1;
+        pc += 3;
+        fused++;
+        continue;
+      }
+      /* push_value a; increment/decrement; pop_variable a => inc_local/dec_local a */
+      if (isPushVariableCode(c0.opcode)
+          && (c1.opcode == LVM_INCREMENT || c1.opcode == LVM_DECREMENT)
+          && isPopVariableCode(c2.opcode)
+          && isSameAddress(c0.u.address, c2.u.address)) {
+        code[out].opcode    = (c1.opcode == LVM_INCREMENT) ? LVM_INC_LOCAL : LVM_DEC_LOCAL;
+        code[out].u.address = c0.u.address;
+        out++;
+        new_pc[pc+1] = new_pc[pc+2] = out - 1;
+        pc += 3;
+        fused++;
+        continue;
+      }
+      /* push_value x; inc_local/dec_local a; pop => inc_local/dec_local a(i++の文) */
+      if (isPushVariableCode(c0.opcode)
+          && (c1.opcode == LVM_INC_LOCAL || c1.opcode == LVM_DEC_LOCAL)
+          && c2.opcode == LVM_POP) {
+        code[out++] = c1;
+        new_pc[pc+1] = new_pc[pc+2] = out - 1;
+        pc += 3;
+        fused++;
+        continue;
+      }
+      /* push_value a; push_immediate v; add/sub => add_local_imm/sub_local_imm a, v */
+      if (isPushVariableCode(c0.opcode)
+          && c1.opcode == LVM_PUSH_IMMEDIATE
+          && (c2.opcode == LVM_ADD || c2.opcode == LVM_SUB)) {
+        code[out].opcode    = (c2.opcode == LVM_ADD) ? LVM_ADD_LOCAL_IMM : LVM_SUB_LOCAL_IMM;
+        code[out].u.address = c0.u.address;
+        out++;
+        code[out].opcode    = LVM_OPERAND;   /* 即値は追加オペランドへ */
+        code[out].u.const_index = c1.u.const_index;
+        out++;
+        new_pc[pc+1] = new_pc[pc+2] = out - 2;
+        pc += 3;
+        fused++;
+        continue;
+      }
+    }
+
+    /* 融合できなければそのまま */
+    code[out++] = c0;
+    pc++;
+  }
+  new_pc[current_code_size + 1] = out;
+
+  /* ジャンプ先を新しいpcに付け替える */
+  for (pc = 0; pc < out; pc++) {
+    if (isJumpCode(code[pc].opcode)) {
+      code[pc].u.jump_pc = new_pc[code[pc].u.jump_pc];
+    } else if (code[pc].opcode == LVM_INVOKE || code[pc].opcode == LVM_TAIL_INVOKE) {
+      code[pc].u.address.address = new_pc[code[pc].u.address.address];
+    }
+  }
+  current_code_size = out - 1;
+
+  MEM_free(new_pc);
+  MEM_free(is_target);
+
+  return fused;
+}
+
 /* 現在のコードサイズを得る */
 int getCodeSize(void)
 {
@@ -118,6 +730,18 @@ LVM_Instruction *getInstruction(void)
   return &(code[0]);
 }
 
+/* 定数表のポインタを得る */
+LL1LL_Value *getConstantPool(void)
+{
+  return constant_pool;
+}
+
+/* 定数表の要素数を得る */
+int getConstantPoolSize(void)
+{
+  return constant_pool_size;
+}
+
 /* デバッグ用・pc番目の命令の表示 */
 void printCode(int pc)
 {
@@ -127,6 +751,7 @@ void printCode(int pc)
     OPRAND_RELADDR,
     OPRAND_JUMP_PC,
     OPRAND_MOVE_TOP,
+    OPRAND_CONCAT_COUNT,
     OPRAND_VOID,
   } OprandKind;
 
@@ -155,6 +780,22 @@ void printCode(int pc)
       printf("pop_variable");
       oprand_kind = OPRAND_RELADDR;
       break;
+    case LVM_PUSH_LOCAL:
+      printf("push_local");
+      oprand_kind = OPRAND_RELADDR;
+      break;
+    case LVM_POP_LOCAL:
+      printf("pop_local");
+      oprand_kind = OPRAND_RELADDR;
+      break;
+    case LVM_PUSH_GLOBAL:
+      printf("push_global");
+      oprand_kind = OPRAND_RELADDR;
+      break;
+    case LVM_POP_GLOBAL:
+      printf("pop_global");
+      oprand_kind = OPRAND_RELADDR;
+      break;
     case LVM_POP:
       printf("pop");
       oprand_kind = OPRAND_VOID;
@@ -183,6 +824,10 @@ void printCode(int pc)
       printf("return");
       oprand_kind = OPRAND_RELADDR;
       break;
+    case LVM_TAIL_INVOKE:
+      printf("tail_invoke");
+      oprand_kind = OPRAND_RELADDR;
+      break;
     case LVM_MINUS:
       printf("minus");
       oprand_kind = OPRAND_VOID;
@@ -223,6 +868,10 @@ void printCode(int pc)
       printf("pow");
       oprand_kind = OPRAND_VOID;
       break;
+    case LVM_CONCAT_N:
+      printf("concat_n");
+      oprand_kind = OPRAND_CONCAT_COUNT;
+      break;
     case LVM_LOGICAL_AND:
       printf("logical_and");
       oprand_kind = OPRAND_VOID;
@@ -263,6 +912,183 @@ void printCode(int pc)
       printf("push_from_stream");
       oprand_kind = OPRAND_VOID;
       break;
+    case LVM_HALT:
+      printf("halt");
+      oprand_kind = OPRAND_VOID;
+      break;
+    case LVM_ADD_INT_INT:
+      printf("add_int_int");
+      oprand_kind = OPRAND_VOID;
+      break;
+    case LVM_ADD_DBL_DBL:
+      printf("add_dbl_dbl");
+      oprand_kind = OPRAND_VOID;
+      break;
+    case LVM_SUB_INT_INT:
+      printf("sub_int_int");
+      oprand_kind = OPRAND_VOID;
+      break;
+    case LVM_SUB_DBL_DBL:
+      printf("sub_dbl_dbl");
+      oprand_kind = OPRAND_VOID;
+      break;
+    case LVM_MUL_INT_INT:
+      printf("mul_int_int");
+      oprand_kind = OPRAND_VOID;
+      break;
+    case LVM_MUL_DBL_DBL:
+      printf("mul_dbl_dbl");
+      oprand_kind = OPRAND_VOID;
+      break;
+    case LVM_CONCAT_STR_STR:
+      printf("concat_str_str");
+      oprand_kind = OPRAND_VOID;
+      break;
+    case LVM_EQ_INT_INT:
+      printf("eq_int_int");
+      oprand_kind = OPRAND_VOID;
+      break;
+    case LVM_NE_INT_INT:
+      printf("ne_int_int");
+      oprand_kind = OPRAND_VOID;
+      break;
+    case LVM_GT_INT_INT:
+      printf("gt_int_int");
+      oprand_kind = OPRAND_VOID;
+      break;
+    case LVM_GE_INT_INT:
+      printf("ge_int_int");
+      oprand_kind = OPRAND_VOID;
+      break;
+    case LVM_LT_INT_INT:
+      printf("lt_int_int");
+      oprand_kind = OPRAND_VOID;
+      break;
+    case LVM_LE_INT_INT:
+      printf("le_int_int");
+      oprand_kind = OPRAND_VOID;
+      break;
+    case LVM_GT_DBL_DBL:
+      printf("gt_dbl_dbl");
+      oprand_kind = OPRAND_VOID;
+      break;
+    case LVM_GE_DBL_DBL:
+      printf("ge_dbl_dbl");
+      oprand_kind = OPRAND_VOID;
+      break;
+    case LVM_LT_DBL_DBL:
+      printf("lt_dbl_dbl");
+      oprand_kind = OPRAND_VOID;
+      break;
+    case LVM_LE_DBL_DBL:
+      printf("le_dbl_dbl");
+      oprand_kind = OPRAND_VOID;
+      break;
+    case LVM_ENTER:
+      printf("enter");
+      oprand_kind = OPRAND_MOVE_TOP;
+      break;
+    case LVM_OPERAND:
+      /* 追加オペランドの中身は直前の命令で決まる */
+      printf("operand");
+      if (pc > 0 && isLocalJumpCode(code[pc-1].opcode)) {
+        oprand_kind = OPRAND_RELADDR;
+      } else if ((pc > 0 && code[pc-1].opcode == LVM_ENTER)
+                 || (pc > 1 && code[pc-2].opcode == LVM_ENTER)
+                 || (pc > 0 && code[pc-1].opcode == LVM_TAIL_INVOKE)) {
+        oprand_kind = OPRAND_MOVE_TOP;
+      } else {
+        oprand_kind = OPRAND_IMMEDIATE;
+      }
+      break;
+    case LVM_ADD_LOCAL_IMM:
+      printf("add_local_imm");
+      oprand_kind = OPRAND_RELADDR;
+      break;
+    case LVM_SUB_LOCAL_IMM:
+      printf("sub_local_imm");
+      oprand_kind = OPRAND_RELADDR;
+      break;
+    case LVM_INC_LOCAL:
+      printf("inc_local");
+      oprand_kind = OPRAND_RELADDR;
+      break;
+    case LVM_DEC_LOCAL:
+      printf("dec_local");
+      oprand_kind = OPRAND_RELADDR;
+      break;
+    case LVM_JLT:
+      printf("jlt");
+      oprand_kind = OPRAND_JUMP_PC;
+      break;
+    case LVM_JLE:
+      printf("jle");
+      oprand_kind = OPRAND_JUMP_PC;
+      break;
+    case LVM_JGT:
+      printf("jgt");
+      oprand_kind = OPRAND_JUMP_PC;
+      break;
+    case LVM_JGE:
+      printf("jge");
+      oprand_kind = OPRAND_JUMP_PC;
+      break;
+    case LVM_JEQ:
+      printf("jeq");
+      oprand_kind = OPRAND_JUMP_PC;
+      break;
+    case LVM_JNE:
+      printf("jne");
+      oprand_kind = OPRAND_JUMP_PC;
+      break;
+    case LVM_JLT_IMM:
+      printf("jlt_imm");
+      oprand_kind = OPRAND_JUMP_PC;
+      break;
+    case LVM_JLE_IMM:
+      printf("jle_imm");
+      oprand_kind = OPRAND_JUMP_PC;
+      break;
+    case LVM_JGT_IMM:
+      printf("jgt_imm");
+      oprand_kind = OPRAND_JUMP_PC;
+      break;
+    case LVM_JGE_IMM:
+      printf("jge_imm");
+      oprand_kind = OPRAND_JUMP_PC;
+      break;
+    case LVM_JEQ_IMM:
+      printf("jeq_imm");
+      oprand_kind = OPRAND_JUMP_PC;
+      break;
+    case LVM_JNE_IMM:
+      printf("jne_imm");
+      oprand_kind = OPRAND_JUMP_PC;
+      break;
+    case LVM_JLT_LOCAL:
+      printf("jlt_local");
+      oprand_kind = OPRAND_JUMP_PC;
+      break;
+    case LVM_JLE_LOCAL:
+      printf("jle_local");
+      oprand_kind = OPRAND_JUMP_PC;
+      break;
+    case LVM_JGT_LOCAL:
+      printf("jgt_local");
+      oprand_kind = OPRAND_JUMP_PC;
+      break;
+    case LVM_JGE_LOCAL:
+      printf("jge_local");
+      oprand_kind = OPRAND_JUMP_PC;
+      break;
+    case LVM_JEQ_LOCAL:
+      printf("jeq_local");
+      oprand_kind = OPRAND_JUMP_PC;
+      break;
+    case LVM_JNE_LOCAL:
+      printf("jne_local");
+      oprand_kind = OPRAND_JUMP_PC;
+      break;
     default:
       fprintf(stderr, "Error! mismatch opcode name in print_code\n");
       exit(1);
@@ -272,48 +1098,10 @@ void printCode(int pc)
   /* オペランドの種類に合わせて印字 */
   switch (oprand_kind) {
     case OPRAND_IMMEDIATE:
-      /* 即値の場合は, 値を表示する */
-      switch (code[pc].u.value.type) {
-        case LL1LL_INT_TYPE:
-          printf(", int:%d\n", code[pc].u.value.u.int_value);
-          return;
-        case LL1LL_DOUBLE_TYPE:
-          printf(", double:%f\n", code[pc].u.value.u.double_value);
-          return;
-        case LL1LL_BOOLEAN_TYPE:
-          if (code[pc].u.value.u.boolean_value == LL1LL_TRUE) {
-            printf(", boolean:true\n");
-          } else {
-            printf(", boolean:false\n");
-          }
-          return;
-        case LL1LL_OBJECT_TYPE:
-          switch (code[pc].u.value.u.object->type) {
-            case STRING_OBJECT:
-              printf(", string:\"%s\"\n", 
-                  code[pc].u.value.u.object->u.str.string_value);
-              return;
-            case ARRAY_OBJECT:
-              /* 配列:これから... */
-              return;
-          }
-        case LL1LL_STREAM_TYPE:
-          if (code[pc].u.value.u.stream_value == stdin) {
-            printf(", stream:stdin\n");
-          } else if (code[pc].u.value.u.stream_value == stdout) {
-            printf(", stream:stdout\n");
-          } else if (code[pc].u.value.u.stream_value == stderr) {
-            printf(", stream:stderr\n");
-          } else {
-            printf(", stream(file pointer):%p\n", code[pc].u.value.u.stream_value);
-          }
-          return;
-        case LL1LL_NULL_TYPE:
-          printf(", null\n");
-          return;
-        default:
-          return;
-      }
+      /* 即値の場合は, 定数表のインデックスと値を表示する */
+      printf(", const:%d", code[pc].u.const_index);
+      printConstant(constant_pool[code[pc].u.const_index]);
+      return;
     case OPRAND_RELADDR:
       printf(", level:%d", code[pc].u.address.block_level);
       printf(", address:%d\n", code[pc].u.address.address);
@@ -324,6 +1112,9 @@ void printCode(int pc)
     case OPRAND_MOVE_TOP:
       printf(", move_top:%d\n", code[pc].u.move_top);
       return;
+    case OPRAND_CONCAT_COUNT:
+      printf(", count:%d\n", code[pc].u.concat_count);
+      return;
     case OPRAND_VOID: /* FALLTHRU */
     default:
       printf("\n");
@@ -332,6 +1123,59 @@ void printCode(int pc)
 
 }
 
+/* デバッグ用・定数の値の表示 */
+static void printConstant(LL1LL_Value value)
+{
+  switch (get_type(value)) {
+    case LL1LL_INT_TYPE:
+      printf(", int:%d\n", get_int_value(value));
+      return;
+    case LL1LL_DOUBLE_TYPE:
+      printf(", double:%f\n", get_double_value(value));
+      return;
+    case LL1LL_BOOLEAN_TYPE:
+      if (get_boolean_value(value) == LL1LL_TRUE) {
+        printf(", boolean:true\n");
+      } else {
+        printf(", boolean:false\n");
+      }
+      return;
+    case LL1LL_OBJECT_TYPE:
+      switch (get_object(value)->type) {
+        case STRING_OBJECT:
+          /* 定数表の文字列は永続領域のリテラルで, ロープにはならない */
+          printf(", string:\"%s\"\n", 
+              get_object(value)->u.str.body->chars);
+          return;
+        case ARRAY_OBJECT:
+          /* 配列:これから... */
+          return;
+        case FREE_OBJECT:    /* FALLTHRU */
+        case FORWARD_OBJECT: /* FALLTHRU */
+        default:
+          printf(", (freed object)\n");
+          return;
+      }
+      return;
+    case LL1LL_STREAM_TYPE:
+      if (get_stream_value(value) == stdin) {
+        printf(", stream:stdin\n");
+      } else if (get_stream_value(value) == stdout) {
+        printf(", stream:stdout\n");
+      } else if (get_stream_value(value) == stderr) {
+        printf(", stream:stderr\n");
+      } else {
+        printf(", stream(file pointer):%p\n", get_stream_value(value));
+      }
+      return;
+    case LL1LL_NULL_TYPE:
+      printf(", null\n");
+      return;
+    default:
+      return;
+  }
+}
+
 /* 全命令列の表示 */
 void printCodeList(void)
 {
@@ -19,6 +19,11 @@ typedef enum {
   LVM_POP_VARIABLE,     /* スタックトップの値をアドレスの変数にポップ */
   LVM_POP,              /* スタックトップの値を捨てる */
   LVM_DUPLICATE,        /* スタックトップの値を複製してプッシュ */
+  /* 変数のプッシュ・ポップのアドレス解決済み版. 汎用版はディスプレイ経由で中間レベルの変数に使う */
+  LVM_PUSH_LOCAL,       /* 現在のフレームの変数をプッシュ : フレーム先頭+アドレス */
+  LVM_POP_LOCAL,        /* スタックトップの値を現在のフレームの変数にポップ */
+  LVM_PUSH_GLOBAL,      /* トップレベルの変数をプッシュ : スタック先頭+アドレス */
+  LVM_POP_GLOBAL,       /* スタックトップの値をトップレベルの変数にポップ */
   /* ジャンプ */
   LVM_JUMP,             /* オペランドの指すpcへジャンプ */
   LVM_JUMP_IF_TRUE,     /* トップがTRUEならば, トップの値を捨て, pcへジャンプ */
@@ -26,6 +31,10 @@ typedef enum {
   /* 関数呼び出し・リターン */
   LVM_INVOKE,           /* 関数を呼び出す. ディスプレイと戻り先をスタックにプッシュし, pcを関数の先頭番地に書き換える */
   LVM_RETURN,           /* スタックトップの値を戻り値として, 関数から返る. スタックトップとディスプレイを復帰し, pcを関数を呼んだ後の状態にする */
+  LVM_ENTER,            /* 関数(トップレベル)の入口. スタックポインタをローカル変数の分だけ動かす.
+                         * 追加オペランドは2語:フレームの最大スタック必要量, 仮引数の数 */
+  LVM_TAIL_INVOKE,      /* 末尾呼び出し. 現在のフレームを呼び先のフレームで置き換え, 戻り先は現在の関数のものを引き継ぐ.
+                         * 追加オペランドは1語:現在の関数の仮引数の数 */
   /* 演算 */
   LVM_MINUS,            /* トップの値の符号を反転 */
   LVM_LOGICAL_NOT,      /* トップの値の論理否定をとる */
@@ -37,6 +46,8 @@ typedef enum {
   LVM_DIV,              /* (一つ下)=(一つ下)/(トップ) */
   LVM_MOD,              /* (一つ下)=(一つ下)%(トップ) */
   LVM_POW,              /* (一つ下)=(一つ下)**(トップ) (累乗) */
+  LVM_CONCAT_N,         /* トップからオペランド個の値(先頭は文字列)を連結した文字列に置き換える.
+                         * 文字列リテラルから始まる+の連鎖をまとめたもの */
   /* 論理演算 */
   LVM_LOGICAL_AND,      /* (一つ下)=(一つ下)&&(トップ) */
   LVM_LOGICAL_OR,       /* (一つ下)=(一つ下)||(トップ) */
@@ -50,33 +61,95 @@ typedef enum {
   /* ストリーム操作系 */
   LVM_POP_TO_STREAM,       /* (一つ下(stream)) << (トップ) */
   LVM_PUSH_FROM_STREAM,      /* TODO:動作未定義 */
+  /* 実行制御 */
+  LVM_HALT,             /* 実行を終了する. 命令列の末尾に必ず置かれる */
+  /* 型特化命令(クイックニング):
+   * 汎用の演算/比較命令が初回実行時のオペランドの型を見て, 自身をこれらの命令に書き換える.
+   * 型が合わなくなったら汎用命令に書き戻す. コンパイラは生成しない */
+  LVM_ADD_INT_INT,      /* LVM_ADD : int + int */
+  LVM_ADD_DBL_DBL,      /* LVM_ADD : double + double */
+  LVM_SUB_INT_INT,      /* LVM_SUB : int - int */
+  LVM_SUB_DBL_DBL,      /* LVM_SUB : double - double */
+  LVM_MUL_INT_INT,      /* LVM_MUL : int * int */
+  LVM_MUL_DBL_DBL,      /* LVM_MUL : double * double */
+  LVM_CONCAT_STR_STR,   /* LVM_ADD : string + string (文字列連結) */
+  LVM_EQ_INT_INT,       /* LVM_EQUAL : int == int */
+  LVM_NE_INT_INT,       /* LVM_NOT_EQUAL : int != int */
+  LVM_GT_INT_INT,       /* LVM_GREATER : int > int */
+  LVM_GE_INT_INT,       /* LVM_GREATER_EQUAL : int >= int */
+  LVM_LT_INT_INT,       /* LVM_LESSTHAN : int < int */
+  LVM_LE_INT_INT,       /* LVM_LESSTHAN_EQUAL : int <= int */
+  LVM_GT_DBL_DBL,       /* LVM_GREATER : double > double */
+  LVM_GE_DBL_DBL,       /* LVM_GREATER_EQUAL : double >= double */
+  LVM_LT_DBL_DBL,       /* LVM_LESSTHAN : double < double */
+  LVM_LE_DBL_DBL,       /* LVM_LESSTHAN_EQUAL : double <= double */
+  /* スーパー命令:覗き穴最適化(peepholeOptimize)が頻出する命令の並びを融合したもの */
+  LVM_OPERAND,          /* 直前の命令の追加オペランド. 命令としては実行されない */
+  LVM_ADD_LOCAL_IMM,    /* 変数+即値(追加オペランド)をプッシュ : push_value; push_immediate; add */
+  LVM_SUB_LOCAL_IMM,    /* 変数-即値(追加オペランド)をプッシュ : push_value; push_immediate; sub */
+  LVM_INC_LOCAL,        /* 変数を1増加 : push_value; increment; pop_variable */
+  LVM_DEC_LOCAL,        /* 変数を1減少 : push_value; decrement; pop_variable */
+  /* 比較分岐命令:比較命令と条件ジャンプを融合したもの. 一つ下とトップを捨て, 条件が成り立てばpcへジャンプ.
+   * 大小比較は, 融合前の比較命令の否定で判定する(例:JGEは (一つ下) < (トップ) が偽ならジャンプ) */
+  LVM_JLT,              /* (一つ下) >= (トップ) が偽ならジャンプ */
+  LVM_JLE,              /* (一つ下)  > (トップ) が偽ならジャンプ */
+  LVM_JGT,              /* (一つ下) <= (トップ) が偽ならジャンプ */
+  LVM_JGE,              /* (一つ下)  < (トップ) が偽ならジャンプ */
+  LVM_JEQ,              /* (一つ下) == (トップ) が真ならジャンプ */
+  LVM_JNE,              /* (一つ下) == (トップ) が偽ならジャンプ */
+  /* 比較分岐命令の即値版:トップと即値(追加オペランド)を比較. トップを捨てる */
+  LVM_JLT_IMM, LVM_JLE_IMM, LVM_JGT_IMM, LVM_JGE_IMM, LVM_JEQ_IMM, LVM_JNE_IMM,
+  /* 比較分岐命令の変数版:トップと変数(追加オペランドのアドレス)を比較. トップを捨てる */
+  LVM_JLT_LOCAL, LVM_JLE_LOCAL, LVM_JGT_LOCAL, LVM_JGE_LOCAL, LVM_JEQ_LOCAL, LVM_JNE_LOCAL,
 } LVM_OpCode;
 
-/* 命令の構造体 */
+/* 命令オペランドのアドレス:RelAddrを32bitに詰めたもの.
+ * 仮引数のアドレスは負になるので, アドレスは符号付き */
+typedef struct {
+  unsigned int block_level:8;   /* 関数(フレーム)のレベル(MAX_BLOCK_LEVEL未満) */
+  signed int   address:24;      /* ブロック内でのアドレス, もしくは関数の先頭pc */
+} LVM_RelAddr;
+
+/* 命令の構造体:オペコードと32bitのオペランド.
+ * 即値は命令に埋め込まず, 定数表(getConstantPool)に置いてそのインデックスを持つ */
 typedef struct {
   LVM_OpCode opcode;    /* オペコード */
   union {               /* オペランド */
-    RelAddr     address;    /* スタック記憶域のアドレス */
-    LL1LL_Value value;      /* 即値 */
-    int         jump_pc;    /* 飛び先pc */
-    int         move_top;   /* スタック移動量 */
+    LVM_RelAddr address;     /* スタック記憶域のアドレス */
+    int         const_index; /* 即値の定数表インデックス */
+    int         jump_pc;     /* 飛び先pc */
+    int         move_top;    /* スタック移動量 */
+    int         concat_count; /* 連結する値の数 */
   } u;
 } LVM_Instruction;
 
 /* 命令生成 返り値は現在のプログラムカウンタ(pc) */
-int genCodeValue(LVM_OpCode opcode, LL1LL_Value);     /* オペランドには値. */
+int genCodeValue(LVM_OpCode opcode, LL1LL_Value);     /* オペランドには値(定数表に登録したインデックス). */
 int genCodeTable(LVM_OpCode opcode, int table_index); /* オペランドには記号表のインデックス */
 int genCodeCalc(LVM_OpCode opcode);                   /* 演算命令の生成 */
+int genCodeConcat(int concat_count);                  /* 文字列連結の連鎖の命令の生成 */
 int genCodeJump(LVM_OpCode opcode, int jump_pc);      /* jump系命令の生成 */
+int genCodeCondJump(LVM_OpCode opcode, int jump_pc);  /* 条件ジャンプ命令の生成. 直前が比較命令なら比較分岐命令に融合する */
 int genCodeMove(LVM_OpCode opcode, int move_top);    /* トップ移動命令の生成 */
 int genCodeReturn(void);                              /* return命令の生成 */
+int genCodeTailInvoke(void);                          /* 直前の関数呼び出しを末尾呼び出しにする. できたら1を返す */
+int genCodeEnter(int num_params);                     /* 関数(トップレベル)の入口命令の生成 */
 void backPatch(int program_count);                    /* 引数のプログラムカウンタの命令をバックパッチ. 飛び先はこの関数を呼んだ次の命令. */
 void changeJumpPc(int pc, int jump_pc);               /* pcのジャンプ命令の飛び先をjump_pcに変更する */
 void changeMoveTop(int pc, int move_top);             /* pcのトップ移動量をmove_topに変更する */
+int isStringImmediate(int pc);                        /* pcの命令が文字列の即値のプッシュか */
 int nextCode(void);                                   /* 次のプログラムカウンタを返す */
+void peepholeOptimize(void);                          /* 生成済みの命令列をスーパー命令に融合し, ジャンプ先を付け替える */
+void computeStackNeed(void);                          /* 各フレームの最大スタック必要量を求め, 入口命令にセットする */
+
+int isJumpCode(LVM_OpCode opcode);                    /* オペランドにジャンプ先pcをとる命令か */
+int isPushVariableCode(LVM_OpCode opcode);            /* 変数をプッシュする命令か */
+int isPopVariableCode(LVM_OpCode opcode);             /* 変数にポップする命令か */
 
 int getCodeSize(void);                                /* 現在のコードサイズを得る */
 LVM_Instruction *getInstruction(void);               /* 命令列のポインタを得る */
+LL1LL_Value *getConstantPool(void);                   /* 定数表のポインタを得る */
+int getConstantPoolSize(void);                        /* 定数表の要素数を得る */
 
 /* デバッグ用・pc番目の命令の表示 */
 void printCode(int pc);
@@ -1,254 +1,1876 @@
 #include "heap.h"
 
-/* FIXME: 定数に代入したオブジェクトはどうする
- *        アイデア:記号表を走査し, constならばマーク
- *        あるいは, constならスイープしない          */
-
-/* ヒープ領域の先頭を指すポインタ */
-static LL1LL_Object *heap_head;
-
-static void addHeapEntry(LL1LL_Object *entry);    /* ヒープ領域管理リストにエントリを追加 */
-static void deleteHeapEntry(LL1LL_Object *entry); /* ヒープ領域管理リストのエントリを削除 */
-static void gc_mark(void);  /* 参照できるオブジェクトを辿ってマークをつける */
-static void gc_sweep(void); /* マークのついていないオブジェクトの領域を開放する */
-static void array_mark(LL1LL_Object *ary_ptr);   /* 配列の再帰的マーク */
-static void array_sweep(LL1LL_Object *ary_ptr);  /* 配列の再帰的領域解放:要素から先にマークを確認し, 開放していく */
-
-/* 双方向リストの先頭にエントリ(領域割り当て済み)を追加する */
-static void addHeapEntry(LL1LL_Object *entry)
-{
-  if (heap_head == NULL) {
-    /* 初期状態ならば, 前後ろ共にNULLで初期化 */
-    heap_head       = entry;    /* 先頭に挿入 */
-    heap_head->prev = NULL;
-    heap_head->next = NULL;
+/* 空きセル:空きリストの要素. 空いている中身のセルの先頭に次のセルへのポインタを置く */
+typedef union HeapCell_tag {
+  union HeapCell_tag *next;  /* 空きリストの次のセル */
+  double             align;  /* セルの境界合わせ用 */
+} HeapCell;
+
+/* スラブのビットマップの語数. オブジェクトのスラブのセル数分のビットを持つ */
+#define SLAB_BITMAP_WORDS ((HEAP_SLAB_SIZE / sizeof(LL1LL_Object) + 63) / 64)
+
+/* スラブ:同じ大きさのセルを並べた, HEAP_SLAB_SIZEバイトの領域.
+ * HEAP_SLAB_SIZEの境界に置くので, オブジェクトのアドレスからスラブが分かる.
+ * 先頭にこの構造体があり, その後ろにセルが並ぶ.
+ * オブジェクトのスラブでは, GCの情報をオブジェクトに持たせずにビットマップに持つ(i番目のセルがi番目のビット) */
+typedef struct HeapSlab_tag {
+  struct HeapSlab_tag *next;  /* 同じサイズクラスの次のスラブ */
+  int                 num_cells;  /* セルの数 */
+  uint64_t            alloc_bits[SLAB_BITMAP_WORDS];      /* 割り当て中のセル */
+  uint64_t            mark_bits[SLAB_BITMAP_WORDS];       /* マーク済み(黒, 灰色)のセル */
+  uint64_t            remembered_bits[SLAB_BITMAP_WORDS]; /* 記憶集合に入っている配列のセル */
+  HeapCell            cells[];    /* セルの並び(cell_sizeバイトずつ) */
+} HeapSlab;
+
+/* サイズクラス:cell_sizeバイトのセルの割り当て元 */
+typedef struct {
+  size_t    cell_size;  /* セルの大きさ(バイト) */
+  HeapSlab  *slabs;     /* このクラスのスラブのリスト */
+  void      *free_list; /* 空きセルのリスト */
+} SizeClass;
+
+/* オブジェクト(ヘッダ)のサイズクラス. 空きセルはtypeをFREE_OBJECTにして, u.free_nextでつなぐ.
+ * GCはこのクラスのスラブを走査してスイープする */
+static SizeClass object_class = { sizeof(LL1LL_Object), NULL, NULL };
+/* 中身(文字列, 配列の要素)のサイズクラス. HEAP_MIN_PAYLOADバイトから倍々でHEAP_MAX_PAYLOADバイトまで.
+ * それより大きい中身はMEM_mallocで確保する */
+static SizeClass payload_class[HEAP_NUM_PAYLOAD_CLASSES];
+
+/* スラブを切り出す領域. HEAP_REGION_SLABS枚ずつ確保し, HEAP_SLAB_SIZEの境界に揃えて切り出す */
+static char *region_top = NULL;
+static char *region_end = NULL;
+
+/* ナーサリ(新世代):オブジェクトをヘッダと中身を続けて前詰めで割り当てる領域.
+ * マイナーGCで生きているオブジェクトを旧世代(スラブ)にコピーし, 丸ごと空にする */
+static char *nursery_start = NULL;  /* ナーサリの先頭 */
+static char *nursery_top   = NULL;  /* 次に割り当てる位置 */
+static char *nursery_end   = NULL;  /* ナーサリの末尾 */
+static LL1LL_Boolean nursery_overflow = LL1LL_FALSE; /* 安全点の間にナーサリが溢れ, 旧世代に割り当てたか */
+
+/* コンパクションを行うモード(gc_compacting)のヒープ:オブジェクトをヘッダと中身を続けて前詰めで割り当てるチャンクの並び.
+ * このモードではナーサリもスラブも使わず, GCは生きているオブジェクトを新しい1つのチャンクに
+ * 詰めてコピーし(Cheney方式), 元のチャンクは全てOSに返す. 断片化が起きず, 使用量は生きている量に従う */
+typedef struct CompactChunk_tag {
+  struct CompactChunk_tag *next;  /* 前に確保したチャンク */
+  char                    *top;   /* 次に割り当てる位置 */
+  char                    *end;   /* チャンクの末尾 */
+  HeapCell                data[]; /* オブジェクトの並び */
+} CompactChunk;
+
+static LL1LL_Boolean gc_compacting = GC_COMPACTING; /* コンパクションを行うモードか */
+static CompactChunk *compact_chunks = NULL;          /* 割り当て中のチャンク(先頭)とそれ以前のチャンク */
+
+/* 永続領域:コンパイル時の文字列(リテラル, 定数)を置く領域. 同じ内容の文字列は1つを共有する.
+ * ここのオブジェクト(is_literalが真)は実行の最後まで生き続けるので, GCは辿りも解放もしない.
+ * 定数表にはこれと数値しか無いので, 定数表もGCの根にしなくてよい */
+static MEM_Storage literal_storage = NULL;
+
+/* 重複を除く表:内容から文字列を引く開番地法のハッシュ表. リテラルは全て, 実行時に作った文字列は
+ * intern_max_length以下のものを登録する. 同じ内容の文字列は表に一つしか無い.
+ * 実行時の文字列への参照は弱く, 表にあるだけでは生き残らない. GCは死んだものを表から除き,
+ * 移動したものは転送先に付け替える */
+typedef struct {
+  LL1LL_Object *object; /* 文字列. NULLなら空き, intern_deletedを指していれば削除済み */
+  unsigned int hash;    /* 文字列のハッシュ値 */
+} InternSlot;
+
+static InternSlot *intern_table = NULL;
+static int intern_size    = 0;  /* 表の大きさ(2のべき) */
+static int intern_used    = 0;  /* 登録中の文字列の数 */
+static int intern_removed = 0;  /* 削除済みの印の数 */
+static int intern_max_length = HEAP_INTERN_MAX_LENGTH; /* 実行時の文字列を登録する長さの上限 */
+static LL1LL_Object intern_deleted; /* 削除済みの印 */
+/* 新世代の文字列を登録したスロットの番号. マイナーGCはこれだけを付け替える */
+static int *intern_young = NULL;
+static int intern_young_count = 0;
+static int intern_young_alloc = 0;
+
+/* ロープの平坦化で, これから書き写す文字列(かロープ)と, 結果の中での位置 */
+typedef struct {
+  LL1LL_Object *object; /* 文字列かロープ */
+  int          offset;  /* 結果の中での位置 */
+} FlattenEntry;
+static FlattenEntry *flatten_stack = NULL;
+static int flatten_count = 0;
+static int flatten_alloc = 0;
+
+/* 記憶集合:新世代のオブジェクトを指している(かもしれない)旧世代の配列 */
+static LL1LL_Object **remembered_set = NULL;
+static int remembered_count = 0;
+static int remembered_alloc = 0;
+/* マイナーGCで昇格させた配列のうち, 要素をまだ辿っていないもの */
+static LL1LL_Object **promoted_arrays = NULL;
+static int promoted_count = 0;
+static int promoted_alloc = 0;
+
+/* GCの状態 */
+typedef enum {
+  GC_IDLE,      /* GCを行っていない */
+  GC_MARKING,   /* マークフェーズの途中 */
+  GC_SWEEPING,  /* スイープフェーズの途中 */
+} GCState;
+
+static GCState gc_state = GC_IDLE;
+static LL1LL_Boolean gc_incremental = GC_INCREMENTAL;  /* インクリメンタルGCを行うか */
+static long gc_slice_work = GC_SLICE_WORK;             /* 1回の安全点で行うGCの仕事量 */
+static int gc_threads = 1;  /* GCを行うスレッドの数(実行スレッドを含む). 2以上なら並列GC */
+/* マークスタック(灰色のオブジェクト):マーク済みで, 要素をまだ辿り終えていない配列.
+ * 大きな配列はindexから先だけを辿るように分けて積み直すので, 1回の仕事量は配列の大きさに依らない */
+typedef struct {
+  LL1LL_Object *object; /* 配列 */
+  int          index;   /* 次に辿る要素 */
+} MarkStackEntry;
+static MarkStackEntry *mark_stack = NULL;
+static int mark_stack_count = 0;
+static int mark_stack_alloc = 0;
+/* 次にスイープするセル */
+static HeapSlab *sweep_slab = NULL;
+static int sweep_index = 0;
+
+/* GCの起動判定のための割り当て量(バイト) */
+static size_t allocated_bytes = 0;                   /* 前回のGC以降に旧世代に割り当てた量 */
+static size_t live_bytes      = 0;                   /* 前回のGCで生き残った量 */
+static size_t gc_threshold    = GC_INITIAL_THRESHOLD; /* allocated_bytesがこれを超えたらGCを行う */
+
+static HeapSlab *addSlab(SizeClass *size_class);  /* サイズクラスにスラブを追加し, そのスラブを返す */
+static HeapSlab *slabOf(LL1LL_Object *entry);     /* オブジェクトのあるスラブ */
+static int cellIndex(HeapSlab *slab, LL1LL_Object *entry); /* オブジェクトのスラブ内でのセルの番号 */
+static LL1LL_Boolean testBit(uint64_t *bits, int i); /* ビットマップのi番目のビットが立っているか */
+static void setBit(uint64_t *bits, int i);        /* ビットマップのi番目のビットを立てる */
+static void clearBit(uint64_t *bits, int i);      /* ビットマップのi番目のビットを消す */
+static LL1LL_Object *allocObject(LL1LL_ObjectType type); /* オブジェクト(ヘッダ)の割り当て */
+static void *allocPayload(size_t size);           /* 中身の割り当て */
+static void freePayload(void *payload, size_t size); /* 中身の解放 */
+static SizeClass *payloadClass(size_t size);      /* 大きさsizeの中身のサイズクラス. 大きすぎればNULL */
+static void *payloadOf(LL1LL_Object *entry);      /* オブジェクトの中身 */
+static size_t payloadSize(LL1LL_Object *entry);   /* オブジェクトの中身の大きさ(バイト) */
+static void setPayload(LL1LL_Object *entry, void *payload); /* オブジェクトの中身の設定 */
+static LL1LL_Value *childrenOf(LL1LL_Object *entry, int *count); /* オブジェクトが指している値の並び */
+static LL1LL_Boolean hasChildren(LL1LL_Object *entry); /* オブジェクトが他のオブジェクトを指しうるか */
+static size_t objectSize(LL1LL_Object *entry);    /* オブジェクトが占める大きさ(バイト) */
+static void freeObject(LL1LL_Object *entry);      /* オブジェクトの領域を中身ごと解放する */
+static LL1LL_Object *allocYoung(LL1LL_ObjectType type, size_t payload_size); /* 新世代へのオブジェクトの割り当て */
+static LL1LL_Boolean isYoung(LL1LL_Object *entry); /* オブジェクトがナーサリにあるか */
+static unsigned int hashChars(char *chars, int length); /* 文字列のハッシュ値 */
+static LL1LL_Object *internLookup(unsigned int hash, char *chars, int length); /* 重複を除く表から文字列を引く */
+static void internInsert(LL1LL_Object *str, unsigned int hash); /* 重複を除く表に文字列を登録する */
+static void internResize(int size);                 /* 重複を除く表を作り直す */
+static void internRemove(int index);                /* 重複を除く表のindex番目を削除済みにする */
+static size_t stringBodySize(int length);         /* 長さlengthの文字列の本体の大きさ(バイト) */
+static LL1LL_Object *flatString(LL1LL_Object *str); /* 文字列(ロープなら平坦化した結果) */
+static void pushFlattenStack(LL1LL_Object *str, int offset); /* 平坦化のスタックに積む */
+static LL1LL_Boolean isPermanent(LL1LL_Object *entry); /* オブジェクトが永続領域にあるか */
+static size_t cellRound(size_t size);             /* 大きさをセルの境界(8バイト)に切り上げる */
+static CompactChunk *addCompactChunk(size_t size); /* 中身がsizeバイト以上のチャンクを確保する */
+static LL1LL_Object *allocCompact(LL1LL_ObjectType type, size_t payload_size); /* チャンクへのオブジェクトの割り当て */
+static void gc_compact_evacuate(LL1LL_Value *value, CompactChunk *to); /* 値のオブジェクトをチャンクtoにコピーし, 参照を書き換える */
+static void gc_compact(void);                     /* コンパクションを行うGC */
+static LL1LL_Object *promoteObject(LL1LL_Object *entry); /* 新世代のオブジェクトを旧世代にコピーする */
+static void pushObjectList(LL1LL_Object ***list, int *count, int *alloc, LL1LL_Object *entry); /* オブジェクトのリストへの追加 */
+static void gc_evacuate(LL1LL_Value *value); /* 値が新世代のオブジェクトなら昇格させ, 参照を書き換える */
+static void gc_minor(void); /* マイナーGC:ナーサリの生きているオブジェクトを旧世代に移す */
+static void gc_intern_minor(void); /* 重複を除く表の新世代の文字列を付け替えるか除く */
+static void gc_intern_sweep(void); /* 重複を除く表からマークの無い文字列を除く */
+static void gc_intern_compact(void); /* 重複を除く表の文字列をコピー先に付け替えるか除く */
+static LL1LL_Boolean isMarked(LL1LL_Object *entry); /* オブジェクトがマーク済みか */
+static size_t sweepWord(HeapSlab *slab, int w,
+                        void (*release)(LL1LL_Object *entry, void *arg), void *arg); /* ビットマップの1語分のスイープ */
+static void releaseObject(LL1LL_Object *entry, void *arg); /* スイープで空いたオブジェクトの解放 */
+static void value_mark(LL1LL_Value value);          /* 値がオブジェクトなら灰色にする */
+static void pushMarkStack(LL1LL_Object *ary, int index); /* マークスタックに配列を積む */
+static void gc_mark_roots(void);                    /* 根を灰色にする */
+static void clearMarks(void);                       /* 全てのマークを消す */
+static void gc_mark_begin(void);                    /* マークフェーズの開始 */
+static LL1LL_Boolean gc_mark_step(long work);       /* 灰色のオブジェクトを辿ってマークを進める */
+static void gc_mark_finish(void);                   /* マークフェーズの終了 */
+static LL1LL_Boolean gc_sweep_step(long work);      /* マークのついていないオブジェクトの領域を開放していく */
+static void gc_finish(void);                        /* GCのサイクルの終了 */
+static void gc_step(long work);                     /* GCのサイクルを進める */
+#ifndef LL1LL_NO_GC_THREADS
+static void gc_parallel(void);                      /* 並列GCでサイクルを最後まで進める */
+#endif /* LL1LL_NO_GC_THREADS */
+
+/* サイズクラスにスラブを追加し, セルを全て空きリストにつなぐ.
+ * スラブは領域からHEAP_SLAB_SIZEの境界に揃えて切り出す */
+static HeapSlab *addSlab(SizeClass *size_class)
+{
+  HeapSlab *slab;
+  char *region;
+  char *cell;
+  int i;
+
+  if (region_top == region_end) {
+    /* 境界に揃えるための余りの分, 1枚多く確保する */
+    region     = (char *)MEM_malloc(HEAP_SLAB_SIZE * (HEAP_REGION_SLABS + 1));
+    region_top = (char *)(((uintptr_t)region + HEAP_SLAB_SIZE - 1)
+                          & ~(uintptr_t)(HEAP_SLAB_SIZE - 1));
+    region_end = region_top + HEAP_SLAB_SIZE * HEAP_REGION_SLABS;
+  }
+  slab        = (HeapSlab *)region_top;
+  region_top += HEAP_SLAB_SIZE;
+
+  memset(slab, 0, sizeof(HeapSlab));
+  slab->num_cells = (HEAP_SLAB_SIZE - sizeof(HeapSlab)) / size_class->cell_size;
+  slab->next      = size_class->slabs;
+  size_class->slabs = slab;
+
+  /* 後ろのセルから順に空きリストの先頭に積み, 先頭のセルから使われるようにする */
+  for (i = slab->num_cells - 1; i >= 0; i--) {
+    cell = (char *)slab->cells + size_class->cell_size * i;
+    if (size_class == &object_class) {
+      ((LL1LL_Object *)cell)->type        = FREE_OBJECT;
+      ((LL1LL_Object *)cell)->u.free_next = (LL1LL_Object *)size_class->free_list;
+    } else {
+      ((HeapCell *)cell)->next = (HeapCell *)size_class->free_list;
+    }
+    size_class->free_list = cell;
+  }
+
+  return slab;
+}
+
+/* オブジェクト(ヘッダ)を空きリストから割り当てる */
+static LL1LL_Object *allocObject(LL1LL_ObjectType type)
+{
+  LL1LL_Object *new_entry;
+  HeapSlab *slab;
+  int index;
+
+  if (object_class.free_list == NULL) {
+    addSlab(&object_class);
+  }
+  new_entry = (LL1LL_Object *)object_class.free_list;
+  object_class.free_list = new_entry->u.free_next;
+
+  /* オブジェクトの種類と, ビットマップの初期化.
+   * GCの途中で割り当てたものは黒. マークは次のGCの開始で全て消える */
+  new_entry->type = type;
+  slab  = slabOf(new_entry);
+  index = cellIndex(slab, new_entry);
+  setBit(slab->alloc_bits, index);
+  if (gc_state != GC_IDLE) {
+    setBit(slab->mark_bits, index);
+  }
+  return new_entry;
+}
+
+/* オブジェクトのあるスラブ. スラブはHEAP_SLAB_SIZEの境界にある */
+static HeapSlab *slabOf(LL1LL_Object *entry)
+{
+  return (HeapSlab *)((uintptr_t)entry & ~(uintptr_t)(HEAP_SLAB_SIZE - 1));
+}
+
+/* オブジェクトのスラブ内でのセルの番号 */
+static int cellIndex(HeapSlab *slab, LL1LL_Object *entry)
+{
+  return (int)(entry - (LL1LL_Object *)slab->cells);
+}
+
+/* ビットマップのi番目のビットが立っているか */
+static LL1LL_Boolean testBit(uint64_t *bits, int i)
+{
+  return (bits[i / 64] >> (i % 64)) & 1 ? LL1LL_TRUE : LL1LL_FALSE;
+}
+
+/* ビットマップのi番目のビットを立てる */
+static void setBit(uint64_t *bits, int i)
+{
+  bits[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+/* ビットマップのi番目のビットを消す */
+static void clearBit(uint64_t *bits, int i)
+{
+  bits[i / 64] &= ~((uint64_t)1 << (i % 64));
+}
+
+/* 大きさsizeの中身のサイズクラス. スラブから割り当てるには大きすぎればNULL */
+static SizeClass *payloadClass(size_t size)
+{
+  int i;
+  size_t cell_size = HEAP_MIN_PAYLOAD;
+
+  for (i = 0; i < HEAP_NUM_PAYLOAD_CLASSES; i++, cell_size *= 2) {
+    if (size <= cell_size) {
+      /* 初めて使う時にセルの大きさを決める(並列スイープ中は書き込まない) */
+      if (payload_class[i].cell_size == 0) {
+        payload_class[i].cell_size = cell_size;
+      }
+      return &payload_class[i];
+    }
+  }
+  return NULL;
+}
+
+/* 大きさsizeの中身を割り当てる. 小さければスラブから, 大きければMEM_mallocで確保 */
+static void *allocPayload(size_t size)
+{
+  SizeClass *size_class = payloadClass(size);
+  HeapCell *cell;
+
+  if (size_class == NULL) {
+    return MEM_malloc(size);
+  }
+  if (size_class->free_list == NULL) {
+    addSlab(size_class);
+  }
+  cell = (HeapCell *)size_class->free_list;
+  size_class->free_list = cell->next;
+  return cell;
+}
+
+/* allocPayload(size)で割り当てた中身を解放する. 大きさで割り当て元が分かる */
+static void freePayload(void *payload, size_t size)
+{
+  SizeClass *size_class = payloadClass(size);
+
+  if (size_class == NULL) {
+    MEM_free(payload);
+    return;
+  }
+  ((HeapCell *)payload)->next = (HeapCell *)size_class->free_list;
+  size_class->free_list = payload;
+}
+
+/* 文字列srcを永続領域へ割り当てる. 文字列は永続領域へディープコピーされる.
+ * コンパイル時のリテラルと定数で, 実行の最後まで生き続ける. 同じ内容の文字列が既にあれば, それを返す */
+LL1LL_Object* alloc_string(char *src)
+{
+  int length        = (int)strlen(src);
+  unsigned int hash = hashChars(src, length);
+  LL1LL_Object *literal;
+  LL1LL_StringBody *body;
+
+  /* 同じ内容の文字列を探す. 実行前なので, 表には永続領域のものしか無い */
+  literal = internLookup(hash, src, length);
+  if (literal != NULL) {
+    return literal;
+  }
+
+  /* 領域確保 */
+  if (literal_storage == NULL) {
+    literal_storage = MEM_open_storage(0);
+  }
+  literal = (LL1LL_Object *)MEM_storage_malloc(literal_storage, sizeof(LL1LL_Object));
+  body    = (LL1LL_StringBody *)MEM_storage_malloc(literal_storage, stringBodySize(length));
+  /* 内容を埋める */
+  body->length = length;
+  body->hash   = hash;
+  memcpy(body->chars, src, length + 1);
+  literal->type              = STRING_OBJECT;
+  literal->u.str.body        = body;
+  literal->u.str.is_literal  = LL1LL_TRUE;
+  literal->u.str.is_interned = LL1LL_TRUE;
+  /* 重複を除く表に登録 */
+  internInsert(literal, hash);
+
+  return literal;
+}
+
+/* 文字列strがintern_max_length以下の長さの平坦な文字列なら, 重複を除く表を引き,
+ * 同じ内容の文字列があればそれを, 無ければstrを登録して返す.
+ * 同じ内容の文字列が一つにまとまるので, 比較はポインタが同じなら等しく, 両方登録済みで違えば等しくない.
+ * 登録の手間は作った文字列の全てに掛かるので, 同じ文字列を何度も作って比べるプログラムでなければ損になる */
+LL1LL_Object* internString(LL1LL_Object *str)
+{
+  LL1LL_StringBody *body;
+  LL1LL_Object *found;
+
+  if (str->type != STRING_OBJECT || str->u.str.is_interned == LL1LL_TRUE
+      || str->u.str.body->length > intern_max_length) {
+    return str;
+  }
+  body  = str->u.str.body;
+  found = internLookup(stringHash(str), body->chars, body->length);
+  if (found != NULL) {
+    return found;
+  }
+  str->u.str.is_interned = LL1LL_TRUE;
+  internInsert(str, body->hash);
+  return str;
+}
+
+/* 実行時に作った文字列の重複を除く長さの上限を設定する. 0以下なら除かない.
+ * 既に登録したものは表に残るが, 比較の結果は変わらない */
+void setInternStrings(int max_length)
+{
+  intern_max_length = (max_length > 0) ? max_length : 0;
+}
+
+/* 重複を除く表から, ハッシュ値hashの長さlengthの文字列charsと同じ内容の文字列を引く. 無ければNULL */
+static LL1LL_Object *internLookup(unsigned int hash, char *chars, int length)
+{
+  int mask = intern_size - 1;
+  int i;
+  LL1LL_StringBody *body;
+
+  if (intern_size == 0) {
+    return NULL;
+  }
+  for (i = hash & mask; intern_table[i].object != NULL; i = (i + 1) & mask) {
+    if (intern_table[i].hash != hash || intern_table[i].object == &intern_deleted) {
+      continue;
+    }
+    body = intern_table[i].object->u.str.body;
+    if (body->length == length && memcmp(body->chars, chars, length) == 0) {
+      return intern_table[i].object;
+    }
+  }
+  return NULL;
+}
+
+/* 重複を除く表に, ハッシュ値hashの文字列strを登録する. 同じ内容のものが無いことは確認済みであること.
+ * 使用中と削除済みの印が3/4を超えたら, 表を作り直してから登録する */
+static void internInsert(LL1LL_Object *str, unsigned int hash)
+{
+  int size = HEAP_INTERN_TABLE_SIZE;
+  int mask;
+  int i;
+
+  if ((intern_used + intern_removed + 1) * 4 > intern_size * 3) {
+    while (size <= (intern_used + 1) * 2) {
+      size *= 2;
+    }
+    internResize(size);
+  }
+  mask = intern_size - 1;
+  for (i = hash & mask; intern_table[i].object != NULL
+       && intern_table[i].object != &intern_deleted; i = (i + 1) & mask)
+    ;
+  if (intern_table[i].object == &intern_deleted) {
+    intern_removed--;
+  }
+  intern_table[i].object = str;
+  intern_table[i].hash   = hash;
+  intern_used++;
+  if (isYoung(str)) {
+    if (intern_young_count >= intern_young_alloc) {
+      intern_young_alloc = (intern_young_alloc == 0) ? 64 : intern_young_alloc * 2;
+      intern_young = (int *)MEM_realloc(intern_young, sizeof(int) * intern_young_alloc);
+    }
+    intern_young[intern_young_count++] = i;
+  }
+}
+
+/* 重複を除く表を大きさsizeで作り直す. 削除済みの印は無くなり, 新世代のスロットの番号も取り直す */
+static void internResize(int size)
+{
+  InternSlot *old_table = intern_table;
+  int old_size          = intern_size;
+  int i;
+
+  intern_table   = (InternSlot *)MEM_malloc(sizeof(InternSlot) * size);
+  memset(intern_table, 0, sizeof(InternSlot) * size);
+  intern_size    = size;
+  intern_used    = 0;
+  intern_removed = 0;
+  intern_young_count = 0;
+  for (i = 0; i < old_size; i++) {
+    if (old_table[i].object != NULL && old_table[i].object != &intern_deleted) {
+      internInsert(old_table[i].object, old_table[i].hash);
+    }
+  }
+  if (old_table != NULL) {
+    MEM_free(old_table);
+  }
+}
+
+/* 重複を除く表のindex番目の文字列を削除済みにする. 探索が途切れないように空きにはしない */
+static void internRemove(int index)
+{
+  intern_table[index].object = &intern_deleted;
+  intern_used--;
+  intern_removed++;
+}
+
+/* 長さlengthの文字列charsのハッシュ値(FNV-1a). 0は「まだ求めていない」を表すので使わない */
+static unsigned int hashChars(char *chars, int length)
+{
+  unsigned int hash = 2166136261u;
+  int i;
+
+  for (i = 0; i < length; i++) {
+    hash = (hash ^ (unsigned char)chars[i]) * 16777619u;
+  }
+  return (hash == 0) ? 1 : hash;
+}
+
+/* 長さlengthの文字列の本体の大きさ(バイト) */
+static size_t stringBodySize(int length)
+{
+  return sizeof(LL1LL_StringBody) + length + 1;
+}
+
+/* オブジェクトが永続領域にあるか. 永続領域にあるのはリテラルの文字列だけ */
+static LL1LL_Boolean isPermanent(LL1LL_Object *entry)
+{
+  return (entry->type == STRING_OBJECT && entry->u.str.is_literal == LL1LL_TRUE)
+         ? LL1LL_TRUE : LL1LL_FALSE;
+}
+
+/* 長さlen1の文字列str1と長さlen2の文字列str2を連結し, 結果をヒープに登録し, オブジェクト参照ポインタを返す.
+ * 連結結果の殆どはすぐに死ぬので, ナーサリに割り当てる. 短い結果は重複を除いたものを返す */
+LL1LL_Object* cat_string(char *str1, int len1, char *str2, int len2)
+{
+  LL1LL_Object *new_entry;
+
+  /* 完成後の文字列長で領域確保 */
+  new_entry = alloc_string_length(len1 + len2);
+
+  /* 結果の文字列を構成 */
+  memcpy(new_entry->u.str.body->chars, str1, len1);
+  memcpy(new_entry->u.str.body->chars + len1, str2, len2);
+
+  return internString(new_entry);
+}
+
+/* 長さlengthの文字列を割り当てる. 終端文字だけを置くので, 中身(chars[0]からlength文字)は呼んだ側で書き込む */
+LL1LL_Object* alloc_string_length(int length)
+{
+  LL1LL_Object *new_entry;
+  LL1LL_StringBody *body;
+
+  new_entry    = allocYoung(STRING_OBJECT, stringBodySize(length));
+  body         = new_entry->u.str.body;
+  body->length = length;
+  body->hash   = 0;
+  body->chars[length]         = '\0';
+  new_entry->u.str.is_literal  = LL1LL_FALSE;
+  new_entry->u.str.is_interned = LL1LL_FALSE;
+
+  return new_entry;
+}
+
+/* 文字列(かロープ)str1とstr2を連結した文字列を返す.
+ * 長くなる連結は中身をコピーせずにロープにするので, s = s + pieceの繰り返しでも1回の手間はpieceの分で済む.
+ * 短いものは平坦な文字列にする(短いものはロープではない) */
+LL1LL_Object* concatString(LL1LL_Object *str1, LL1LL_Object *str2)
+{
+  LL1LL_Object *new_entry;
+  LL1LL_RopeBody *body;
+  int length = stringLength(str1) + stringLength(str2);
+
+  if (length < HEAP_ROPE_MIN_LENGTH) {
+    /* 短ければ左右とも平坦な文字列 */
+    return cat_string(str1->u.str.body->chars, str1->u.str.body->length,
+                      str2->u.str.body->chars, str2->u.str.body->length);
+  }
+
+  new_entry    = allocYoung(ROPE_OBJECT, sizeof(LL1LL_RopeBody));
+  body         = new_entry->u.rope.body;
+  body->length = length;
+  set_object(body->parts[0], str1);
+  set_object(body->parts[1], str2);
+  /* ナーサリが溢れていれば旧世代に割り当てているので, 配列と同じく書き込みバリアが要る */
+  gcWriteBarrier(new_entry, body->parts[0]);
+  gcWriteBarrier(new_entry, body->parts[1]);
+  return new_entry;
+}
+
+/* 文字列(かロープ)str1に, 長さlen2の文字列str2を連結した文字列を返す. 連結の仕方はconcatStringと同じ */
+LL1LL_Object* appendString(LL1LL_Object *str1, char *str2, int len2)
+{
+  if (stringLength(str1) + len2 < HEAP_ROPE_MIN_LENGTH) {
+    /* 短ければstr1は平坦な文字列 */
+    return cat_string(str1->u.str.body->chars, str1->u.str.body->length, str2, len2);
+  }
+  return concatString(str1, cat_string("", 0, str2, len2));
+}
+
+/* 文字列(かロープ)の長さ. ロープでも平坦化しない */
+int stringLength(LL1LL_Object *str)
+{
+  if (str->type == ROPE_OBJECT) {
+    return str->u.rope.body->length;
+  }
+  return str->u.str.body->length;
+}
+
+/* 文字列(かロープ)の中身の連続した文字列(終端文字付き). ロープは平坦化する */
+char *stringChars(LL1LL_Object *str)
+{
+  return flatString(str)->u.str.body->chars;
+}
+
+/* 文字列ならそのまま, ロープなら平坦化した結果の文字列を返す.
+ * 平坦化した結果はロープのparts[0]に覚えておき(parts[1]はnull), 二度目からはそれを返す */
+static LL1LL_Object *flatString(LL1LL_Object *str)
+{
+  LL1LL_RopeBody *body;
+  LL1LL_Object *result;
+
+  if (str->type != ROPE_OBJECT) {
+    return str;
+  }
+  body = str->u.rope.body;
+  if (get_type(body->parts[1]) == LL1LL_NULL_TYPE) {
+    return get_object(body->parts[0]);
+  }
+
+  /* 結果の文字列を確保し, 中身を書き写す */
+  result = alloc_string_length(body->length);
+  copyStringChars(result->u.str.body->chars, str);
+
+  set_object(body->parts[0], result);
+  set_null(body->parts[1]);
+  gcWriteBarrier(str, body->parts[0]);
+  return result;
+}
+
+/* 文字列(かロープ)strの中身をdestに書き写す. 終端文字は書かない. ロープは平坦化しない.
+ * 深いロープでも再帰しないように, 書き写すものはスタックに積んでおく */
+void copyStringChars(char *dest, LL1LL_Object *str)
+{
+  LL1LL_RopeBody *body;
+  LL1LL_Object *part;
+  int offset;
+
+  pushFlattenStack(str, 0);
+  while (flatten_count > 0) {
+    flatten_count--;
+    part   = flatten_stack[flatten_count].object;
+    offset = flatten_stack[flatten_count].offset;
+    if (part->type == ROPE_OBJECT) {
+      body = part->u.rope.body;
+      if (get_type(body->parts[1]) == LL1LL_NULL_TYPE) {
+        pushFlattenStack(get_object(body->parts[0]), offset);
+      } else {
+        pushFlattenStack(get_object(body->parts[0]), offset);
+        pushFlattenStack(get_object(body->parts[1]),
+                         offset + stringLength(get_object(body->parts[0])));
+      }
+    } else {
+      memcpy(dest + offset, part->u.str.body->chars, part->u.str.body->length);
+    }
+  }
+}
+
+/* 平坦化のスタックに, 文字列(かロープ)strと結果の中での位置offsetを積む. 領域が足りなければ倍々で拡張 */
+static void pushFlattenStack(LL1LL_Object *str, int offset)
+{
+  if (flatten_count >= flatten_alloc) {
+    flatten_alloc = (flatten_alloc == 0) ? 64 : flatten_alloc * 2;
+    flatten_stack = (FlattenEntry *)MEM_realloc(flatten_stack, sizeof(FlattenEntry) * flatten_alloc);
+  }
+  flatten_stack[flatten_count].object = str;
+  flatten_stack[flatten_count].offset = offset;
+  flatten_count++;
+}
+
+/* 文字列のハッシュ値. 初めて求めた時に本体に覚えておく. ロープは平坦化した結果のもの */
+unsigned int stringHash(LL1LL_Object *str)
+{
+  LL1LL_StringBody *body = flatString(str)->u.str.body;
+
+  if (body->hash == 0) {
+    body->hash = hashChars(body->chars, body->length);
+  }
+  return body->hash;
+}
+
+/* 二つの文字列が等しいか. 同じオブジェクトか, 重複を除いた文字列同士なら中身を見ない.
+ * 長さかハッシュ値が違えば中身を比べない */
+LL1LL_Boolean equalString(LL1LL_Object *str1, LL1LL_Object *str2)
+{
+  int length = stringLength(str1);
+
+  if (str1 == str2) {
+    return LL1LL_TRUE;
+  }
+  if (str1->type == STRING_OBJECT && str1->u.str.is_interned == LL1LL_TRUE
+      && str2->type == STRING_OBJECT && str2->u.str.is_interned == LL1LL_TRUE) {
+    /* 重複を除いた文字列同士は, 別のオブジェクトなら内容も違う */
+    return LL1LL_FALSE;
+  }
+  if (length != stringLength(str2)
+      || stringHash(str1) != stringHash(str2)) {
+    return LL1LL_FALSE;
+  }
+  return memcmp(stringChars(str1), stringChars(str2), length) == 0
+         ? LL1LL_TRUE : LL1LL_FALSE;
+}
+
+/* 二つの文字列を辞書順で比べる. strcmpと同じく, str1が小さければ負, 等しければ0, 大きければ正 */
+int compareString(LL1LL_Object *str1, LL1LL_Object *str2)
+{
+  int len1 = stringLength(str1);
+  int len2 = stringLength(str2);
+  int result;
+
+  result = memcmp(stringChars(str1), stringChars(str2), (len1 < len2) ? len1 : len2);
+  if (result != 0) {
+    return result;
+  }
+  return (len1 > len2) - (len1 < len2);
+}
+
+/* サイズsizeの配列をヒープ領域へ割り当てる. 要素の初期化は特に行わず, 呼んだ側で頑張ってもらう.
+ * 要素に新世代のオブジェクトを書き込む時は, gcWriteBarrierを呼ぶこと */
+LL1LL_Object* alloc_array(size_t size)
+{
+  /* 領域確保 */
+  LL1LL_Object *new_entry      = allocYoung(ARRAY_OBJECT, sizeof(LL1LL_Value) * size);
+  /* サイズ設定 */
+  new_entry->u.ary.size        = size;
+  new_entry->u.ary.alloc_size  = size * sizeof(LL1LL_Value); /* TODO:これは正しくない（配列の配列の場合は, 要素の配列のサイズも加算しなくてはいけない）が, 今のところ問題にはなっていない */
+
+  return new_entry;
+
+}
+
+/* 新世代に, 中身がpayload_sizeバイトのオブジェクトを割り当てる.
+ * ヘッダの直後に中身を置く. 大きすぎるオブジェクトと, ナーサリが溢れた時は旧世代に割り当てる.
+ * コンパクションを行うモードではチャンクに割り当てる */
+static LL1LL_Object *allocYoung(LL1LL_ObjectType type, size_t payload_size)
+{
+  LL1LL_Object *new_entry;
+  /* ヘッダと中身を合わせて, セルの境界(8バイト)に揃える */
+  size_t size = cellRound(sizeof(LL1LL_Object) + payload_size);
+  void *payload;
+
+  if (gc_compacting == LL1LL_TRUE) {
+    return allocCompact(type, payload_size);
+  }
+
+  if (nursery_start == NULL) {
+    nursery_start = (char *)MEM_malloc(HEAP_NURSERY_SIZE);
+    nursery_top   = nursery_start;
+    nursery_end   = nursery_start + HEAP_NURSERY_SIZE;
+  }
+
+  if (payload_size <= HEAP_NURSERY_MAX_PAYLOAD
+      && size <= (size_t)(nursery_end - nursery_top)) {
+    new_entry    = (LL1LL_Object *)nursery_top;
+    nursery_top += size;
+    new_entry->type = type;
+    payload = new_entry + 1;
   } else {
-    /* 一版の場合は, 先頭に追加 */
-    heap_head->prev = entry;      /* 先頭の前に追加 */
-    entry->next     = heap_head;  /* エントリの次は先頭 */
-    entry->prev     = NULL;       /* エントリの前はNULL */
-    heap_head       = entry;      /* 先頭の更新 */
+    /* GCは安全点でしか行えないので, ここでは旧世代に割り当てて次の安全点でマイナーGCを行う */
+    if (payload_size <= HEAP_NURSERY_MAX_PAYLOAD) {
+      nursery_overflow = LL1LL_TRUE;
+    }
+    new_entry = allocObject(type);
+    payload   = allocPayload(payload_size);
+    allocated_bytes += sizeof(LL1LL_Object) + payload_size;
+  }
+
+  setPayload(new_entry, payload);
+  return new_entry;
+}
+
+/* オブジェクトがナーサリにあるか */
+static LL1LL_Boolean isYoung(LL1LL_Object *entry)
+{
+  return ((char *)entry >= nursery_start && (char *)entry < nursery_end)
+         ? LL1LL_TRUE : LL1LL_FALSE;
+}
+
+/* 大きさをセルの境界(8バイト)に切り上げる */
+static size_t cellRound(size_t size)
+{
+  return (size + sizeof(HeapCell) - 1) & ~(sizeof(HeapCell) - 1);
+}
+
+/* 配列aryの要素にvalueを書き込んだ後に呼ぶ書き込みバリア.
+ * 旧世代の配列が新世代のオブジェクトを指すようになったら, 記憶集合に入れる.
+ * マーク中に黒の配列に白のオブジェクトを書き込んだら, そのオブジェクトを灰色にする */
+void gcWriteBarrier(LL1LL_Object *ary, LL1LL_Value value)
+{
+  HeapSlab *slab;
+
+  if (gc_compacting == LL1LL_TRUE) {
+    /* 世代もマーク中の状態も無いので, 何もしなくてよい */
+    return;
+  }
+  if (gc_state == GC_MARKING
+      && !isYoung(ary) && isMarked(ary)) {
+    value_mark(value);
+  }
+  if (get_type(value) == LL1LL_OBJECT_TYPE
+      && isYoung(get_object(value))
+      && !isYoung(ary)) {
+    slab = slabOf(ary);
+    if (!testBit(slab->remembered_bits, cellIndex(slab, ary))) {
+      setBit(slab->remembered_bits, cellIndex(slab, ary));
+      pushObjectList(&remembered_set, &remembered_count, &remembered_alloc, ary);
+    }
+  }
+}
+
+/* オブジェクトのリストに追加する. 領域が足りなければ倍々で拡張 */
+static void pushObjectList(LL1LL_Object ***list, int *count, int *alloc, LL1LL_Object *entry)
+{
+  if (*count >= *alloc) {
+    *alloc = (*alloc == 0) ? 64 : *alloc * 2;
+    *list  = (LL1LL_Object **)MEM_realloc(*list, sizeof(LL1LL_Object *) * *alloc);
+  }
+  (*list)[(*count)++] = entry;
+}
+
+/* オブジェクトの中身(文字列の本体, 配列の要素, ロープの本体) */
+static void *payloadOf(LL1LL_Object *entry)
+{
+  switch (entry->type) {
+    case STRING_OBJECT:
+      return entry->u.str.body;
+    case ROPE_OBJECT:
+      return entry->u.rope.body;
+    default:
+      /* should be ARRAY_OBJECT here */
+      return entry->u.ary.array_value;
+  }
+}
+
+/* オブジェクトの中身の大きさ(バイト) */
+static size_t payloadSize(LL1LL_Object *entry)
+{
+  switch (entry->type) {
+    case STRING_OBJECT:
+      return stringBodySize(entry->u.str.body->length);
+    case ROPE_OBJECT:
+      return sizeof(LL1LL_RopeBody);
+    default:
+      /* should be ARRAY_OBJECT here */
+      return sizeof(LL1LL_Value) * entry->u.ary.size;
+  }
+}
+
+/* オブジェクトの中身をpayloadにする. オブジェクトの種類は設定済みであること */
+static void setPayload(LL1LL_Object *entry, void *payload)
+{
+  switch (entry->type) {
+    case STRING_OBJECT:
+      entry->u.str.body        = (LL1LL_StringBody *)payload;
+      break;
+    case ROPE_OBJECT:
+      entry->u.rope.body       = (LL1LL_RopeBody *)payload;
+      break;
+    default:
+      /* should be ARRAY_OBJECT here */
+      entry->u.ary.array_value = (LL1LL_Value *)payload;
+      break;
+  }
+}
+
+/* オブジェクトが指している値の並びと, その数(countに返す).
+ * 配列は要素, ロープは左右の文字列. 文字列は何も指さないのでNULL */
+static LL1LL_Value *childrenOf(LL1LL_Object *entry, int *count)
+{
+  switch (entry->type) {
+    case ARRAY_OBJECT:
+      *count = entry->u.ary.size;
+      return entry->u.ary.array_value;
+    case ROPE_OBJECT:
+      *count = 2;
+      return entry->u.rope.body->parts;
+    default:
+      *count = 0;
+      return NULL;
+  }
+}
+
+/* オブジェクトが他のオブジェクトを指しうるか(GCで中身を辿る必要があるか) */
+static LL1LL_Boolean hasChildren(LL1LL_Object *entry)
+{
+  return (entry->type == ARRAY_OBJECT || entry->type == ROPE_OBJECT)
+         ? LL1LL_TRUE : LL1LL_FALSE;
+}
+
+/* オブジェクトが占める大きさ(バイト). 割り当て量の計上に使う */
+static size_t objectSize(LL1LL_Object *entry)
+{
+  return sizeof(LL1LL_Object) + payloadSize(entry);
+}
+
+/* オブジェクトの領域を中身ごと解放し, セルを空きリストに戻す.
+ * 配列の要素やロープの左右のオブジェクトはそれぞれがスラブにあるので, ここでは解放しない.
+ * 割り当てのビットはスイープが消す */
+static void freeObject(LL1LL_Object *entry)
+{
+  freePayload(payloadOf(entry), payloadSize(entry));
+  entry->type        = FREE_OBJECT;
+  entry->u.free_next = (LL1LL_Object *)object_class.free_list;
+  object_class.free_list = entry;
+}
+
+/* 新世代のオブジェクトを旧世代にコピーし, 元のオブジェクトに転送先を残す.
+ * 既にコピー済みなら転送先を返す */
+static LL1LL_Object *promoteObject(LL1LL_Object *entry)
+{
+  LL1LL_Object *new_entry;
+  size_t payload_size;
+
+  if (entry->type == FORWARD_OBJECT) {
+    return entry->u.forward;
+  }
+
+  new_entry    = allocObject(entry->type);
+  new_entry->u = entry->u;
+  payload_size = payloadSize(entry);
+  setPayload(new_entry, allocPayload(payload_size));
+  memcpy(payloadOf(new_entry), payloadOf(entry), payload_size);
+  if (hasChildren(new_entry)) {
+    /* 配列の要素, ロープの左右は後で辿る */
+    pushObjectList(&promoted_arrays, &promoted_count, &promoted_alloc, new_entry);
+  }
+  allocated_bytes += sizeof(LL1LL_Object) + payload_size;
+
+  entry->type      = FORWARD_OBJECT;
+  entry->u.forward = new_entry;
+  return new_entry;
+}
+
+/* 値が新世代のオブジェクトなら旧世代に昇格させ, 値を転送先に書き換える */
+static void gc_evacuate(LL1LL_Value *value)
+{
+  if (get_type(*value) == LL1LL_OBJECT_TYPE
+      && isYoung(get_object(*value))) {
+    set_object(*value, promoteObject(get_object(*value)));
+  }
+}
+
+/* マイナーGC. 根(スタック)と記憶集合から辿れる新世代のオブジェクトを
+ * 全て旧世代に昇格させ, ナーサリを空にする. 手間は生きている新世代のオブジェクトの量に比例する */
+static void gc_minor(void)
+{
+  int i;
+  int stack_top          = getStackTop();
+  LL1LL_Value *stack_p   = getStackPointer();
+  LL1LL_Object *ary;
+  LL1LL_Value *children;
+  int count;
+  HeapSlab *slab;
+
+  if (nursery_start == NULL) {
+    return;
+  }
+
+  /* 根から直接指されているオブジェクト */
+  for (i = 0; i < stack_top; i++) {
+    gc_evacuate(&stack_p[i]);
+  }
+
+  /* 旧世代の配列から指されているオブジェクト */
+  for (i = 0; i < remembered_count; i++) {
+    slab = slabOf(remembered_set[i]);
+    clearBit(slab->remembered_bits, cellIndex(slab, remembered_set[i]));
+    pushObjectList(&promoted_arrays, &promoted_count, &promoted_alloc, remembered_set[i]);
   }
+  remembered_count = 0;
+
+  /* 昇格させた配列(とロープ)の要素を辿る(昇格が止まるまで).
+   * マーク中は昇格させたオブジェクトは黒なので, 要素の旧世代のオブジェクトを灰色にする */
+  while (promoted_count > 0) {
+    ary      = promoted_arrays[--promoted_count];
+    children = childrenOf(ary, &count);
+    for (i = 0; i < count; i++) {
+      gc_evacuate(&children[i]);
+      if (gc_state == GC_MARKING) {
+        value_mark(children[i]);
+      }
+    }
+  }
+
+  /* 重複を除く表の新世代の文字列は, 転送先に付け替えるか除く */
+  gc_intern_minor();
+
+  /* 生きているものは全て旧世代に移ったので, ナーサリは丸ごと空く */
+  nursery_top      = nursery_start;
+  nursery_overflow = LL1LL_FALSE;
 }
 
-/* 双方向リストのエントリを削除する
- * メモリ解放は行わない. */
-static void deleteHeapEntry(LL1LL_Object *entry)
+/* 重複を除く表に登録した新世代の文字列を, 昇格していれば転送先に付け替え, 死んでいれば除く.
+ * 表への参照は弱いので, 昇格したかどうかは他からの参照だけで決まっている */
+static void gc_intern_minor(void)
 {
-  if (heap_head == NULL) {
-    /* 空リストから要素は削除できない */
-    fprintf(stderr, "Error, delete entry from NULL list \n");
-    exit(1);
-  } else {
-    if (entry->prev == NULL) {
-      /* エントリが先頭ならば, エントリの次の要素を先頭に */
-      heap_head         = entry->next;
-      entry->next->prev = NULL;
+  int i;
+  LL1LL_Object *entry;
+
+  for (i = 0; i < intern_young_count; i++) {
+    entry = intern_table[intern_young[i]].object;
+    if (entry->type == FORWARD_OBJECT) {
+      intern_table[intern_young[i]].object = entry->u.forward;
     } else {
-      /* 一般の要素の削除 */
-      entry->prev->next = entry->next;  /* 前の次はエントリの次 */
-      entry->next->prev = entry->prev;  /* 次の前はエントリの前 */
+      internRemove(intern_young[i]);
     }
-    /* リストから削除したエントリの次と前はNULL */
-    entry->next         = NULL;
-    entry->prev         = NULL;
   }
+  intern_young_count = 0;
 }
 
-/* 文字列srcをヒープ領域へ割り当てる. 文字列はヒープ領域へディープコピーされる. */
-LL1LL_Object* alloc_string(char *src, LL1LL_Boolean is_literal)
+/* 重複を除く表から, マークの無い(スイープで解放される)文字列を除く.
+ * マークが終わり, 新世代が空になった後に呼ぶ. 永続領域のものはそのまま */
+static void gc_intern_sweep(void)
 {
-  /* 領域確保 */
-  LL1LL_Object *new_entry       = (LL1LL_Object *)MEM_malloc(sizeof(LL1LL_Object));
-  /* オブジェクトの種類と, マークの初期化 */
-  new_entry->type               = STRING_OBJECT;
-  new_entry->marked             = LL1LL_FALSE;
-  /* 内容を埋める */
-  new_entry->u.str.string_value = MEM_strdup(src);
-  new_entry->u.str.is_literal   = is_literal;
-  /* ヒープ管理リストへ追加 */
-  addHeapEntry(new_entry);
+  int i;
+  LL1LL_Object *entry;
 
-  return new_entry;
+  for (i = 0; i < intern_size; i++) {
+    entry = intern_table[i].object;
+    if (entry != NULL && entry != &intern_deleted
+        && !isPermanent(entry) && !isMarked(entry)) {
+      internRemove(i);
+    }
+  }
 }
 
-/* 引数の文字列をstr1str2で連結し, 結果をヒープに登録し, オブジェクト参照ポインタを返す */
-LL1LL_Object* cat_string(char *str1, char *str2)
+/* オブジェクトが黒か灰色(マーク済み)か. マークはスラブのビットマップにある */
+static LL1LL_Boolean isMarked(LL1LL_Object *entry)
 {
-  char* str_result;    /* 連結結果の文字列 */
-  int str_len;         /* 文字列長 */
-  /* 領域確保 */
-  LL1LL_Object *new_entry       = (LL1LL_Object *)MEM_malloc(sizeof(LL1LL_Object));
-  /* オブジェクトの種類と, マークの初期化 */
-  new_entry->type               = STRING_OBJECT;
-  new_entry->marked             = LL1LL_FALSE;
-
-  /* 完成後の文字列長を取得し, 結果の文字列を構成 */
-  str_len    = strlen(str1) + strlen(str2) + 1;
-  str_result = (char *)MEM_malloc(sizeof(char) * str_len);
-  strcat(str_result, str1);
-  strcat(str_result, str2);
-
-  /* 結果をヒープに登録 */
-  new_entry->u.str.string_value = str_result;
-  new_entry->u.str.is_literal   = LL1LL_FALSE;
-  /* ヒープ管理リストへ追加 */
-  addHeapEntry(new_entry);
+  HeapSlab *slab = slabOf(entry);
+  return testBit(slab->mark_bits, cellIndex(slab, entry));
+}
 
-  return new_entry;
+/* 値が旧世代のオブジェクトなら灰色にする. 文字列は中身を辿る必要が無いのですぐ黒に,
+ * 配列はマークしてマークスタックに積み, 要素は後でgc_mark_stepが辿る.
+ * マーク済みのものは積まないので, 共有された配列も一度しか辿らない */
+static void value_mark(LL1LL_Value value)
+{
+  LL1LL_Object *entry;
+  HeapSlab *slab;
+  int index;
+
+  if (get_type(value) != LL1LL_OBJECT_TYPE) {
+    return;
+  }
+  entry = get_object(value);
+  if (isYoung(entry) || isPermanent(entry)) {
+    /* 新世代はマイナーGCが面倒を見る. 永続領域はGCの対象外 */
+    return;
+  }
+  slab  = slabOf(entry);
+  index = cellIndex(slab, entry);
+  if (testBit(slab->mark_bits, index)) {
+    /* マーク済みなら何もしない */
+    return;
+  }
+  setBit(slab->mark_bits, index);
+  if (hasChildren(entry)) {
+    pushMarkStack(entry, 0);
+  }
 }
 
-/* サイズsizeの配列をヒープ領域へ割り当てる. 要素の初期化は特に行わず, 呼んだ側で頑張ってもらう */
-LL1LL_Object* alloc_array(size_t size)
+/* マークスタックに配列aryを積む. index番目の要素から辿る. 領域が足りなければ倍々で拡張 */
+static void pushMarkStack(LL1LL_Object *ary, int index)
 {
-  /* 領域確保 */
-  LL1LL_Object *new_entry      = (LL1LL_Object *)MEM_malloc(sizeof(LL1LL_Object));
-  /* オブジェクトの種類と, マークの初期化 */
-  new_entry->type              = ARRAY_OBJECT;
-  new_entry->marked            = LL1LL_FALSE;
-  /* 配列として, LL1LL_Valueの配列を動的に確保する */
-  new_entry->u.ary.array_value = (LL1LL_Value *)MEM_malloc(sizeof(LL1LL_Value) * size);
-  /* サイズ設定 */
-  new_entry->u.ary.size        = size;
-  new_entry->u.ary.alloc_size  = size * sizeof(LL1LL_Value); /* TODO:これは正しくない（配列の配列の場合は, 要素の配列のサイズも加算しなくてはいけない）が, 今のところ問題にはなっていない */
-  /* ヒープ管理リストに追加 */
-  addHeapEntry(new_entry);
+  if (mark_stack_count >= mark_stack_alloc) {
+    mark_stack_alloc = (mark_stack_alloc == 0) ? 256 : mark_stack_alloc * 2;
+    mark_stack = (MarkStackEntry *)MEM_realloc(mark_stack, sizeof(MarkStackEntry) * mark_stack_alloc);
+  }
+  mark_stack[mark_stack_count].object = ary;
+  mark_stack[mark_stack_count].index  = index;
+  mark_stack_count++;
+}
+
+/* 根(スタックのトップ未満)を灰色にする */
+static void gc_mark_roots(void)
+{
+  int i;
+  int stack_top        = getStackTop();
+  LL1LL_Value *stack_p = getStackPointer();
+
+  for (i = 0; i < stack_top; i++) {
+    value_mark(stack_p[i]);
+  }
+}
+
+/* 全てのスラブのマークのビットマップを消し, 全オブジェクトを白にする */
+static void clearMarks(void)
+{
+  HeapSlab *slab;
+
+  for (slab = object_class.slabs; slab != NULL; slab = slab->next) {
+    memset(slab->mark_bits, 0, sizeof(slab->mark_bits));
+  }
+}
+
+/* GCのマークフェーズの開始. 全オブジェクトを白にし, 根を灰色にする.
+ * 定数表は永続領域の文字列と数値しか指さないので, 根にしなくてよい */
+static void gc_mark_begin(void)
+{
+  clearMarks();
+  gc_state = GC_MARKING;
+  gc_mark_roots();
+}
+
+/* マークスタックから配列を取り出して要素を辿る. 再帰はせず, 見つけた配列はマークスタックに積む.
+ * work個分の要素を辿ったら戻る. 辿りきれなかった配列は残りを積み直す.
+ * マークスタックが空になったらLL1LL_TRUEを返す */
+static LL1LL_Boolean gc_mark_step(long work)
+{
+  LL1LL_Object *ary;
+  LL1LL_Value *children;
+  int i, end;
+
+  while (mark_stack_count > 0) {
+    if (work <= 0) {
+      return LL1LL_FALSE;
+    }
+    mark_stack_count--;
+    ary = mark_stack[mark_stack_count].object;
+    i   = mark_stack[mark_stack_count].index;
+    children = childrenOf(ary, &end);
+    if (end - i > work) {
+      end = i + (int)work;
+      pushMarkStack(ary, end);  /* 残りは後で */
+    }
+    work -= end - i + 1;
+    for (; i < end; i++) {
+      value_mark(children[i]);
+    }
+  }
+  return LL1LL_TRUE;
+}
+
+/* GCのマークフェーズの終了. マーク中にスタックには書き込みバリアを掛けていないので,
+ * ここで止めて根を辿り直し, 灰色が無くなるまでマークしてからスイープに移る.
+ * 新世代のオブジェクトはマークしないので, 先にマイナーGCで全て旧世代に移しておく */
+static void gc_mark_finish(void)
+{
+  gc_minor();
+  gc_mark_roots();
+  gc_mark_step(LONG_MAX);
+  gc_intern_sweep();
+  gc_state      = GC_SWEEPING;
+  sweep_slab    = object_class.slabs;
+  sweep_index   = 0;
+  live_bytes    = 0;
+}
+
+/* スラブのビットマップのw語目に当たる64個のセルをスイープする.
+ * 割り当て中でマークの無いセルをrelease(entry, arg)で解放し, 割り当てのビットを落とす.
+ * 生き残った量(バイト)を返す */
+static size_t sweepWord(HeapSlab *slab, int w,
+                        void (*release)(LL1LL_Object *entry, void *arg), void *arg)
+{
+  LL1LL_Object *cells = (LL1LL_Object *)slab->cells + w * 64;
+  uint64_t live = slab->alloc_bits[w] & slab->mark_bits[w];
+  uint64_t dead = slab->alloc_bits[w] & ~slab->mark_bits[w];
+  size_t bytes = 0;
+
+  slab->alloc_bits[w] = live;
+  for (; dead != 0; dead &= dead - 1) {
+    release(&cells[__builtin_ctzll(dead)], arg);
+  }
+  for (; live != 0; live &= live - 1) {
+    bytes += objectSize(&cells[__builtin_ctzll(live)]);
+  }
+  return bytes;
+}
 
+/* スイープで空いたオブジェクトを空きリストに戻す */
+static void releaseObject(LL1LL_Object *entry, void *arg)
+{
+  (void)arg;
+  freeObject(entry);
+}
+
+/* GCのスイープフェーズをwork個分のセルだけ進める. スイープが終わったらLL1LL_TRUEを返す.
+ * ビットマップを1語(64セル)ずつ調べる. sweep_indexは次に調べる語.
+ * スラブはリストの先頭に追加されるので, スイープ中に増えたスラブは辿らない(中身は全て黒か空き) */
+static LL1LL_Boolean gc_sweep_step(long work)
+{
+  while (sweep_slab != NULL) {
+    for (; sweep_index * 64 < sweep_slab->num_cells; sweep_index++) {
+      if (work <= 0) {
+        return LL1LL_FALSE;
+      }
+      work -= 64;
+      live_bytes += sweepWord(sweep_slab, sweep_index, releaseObject, NULL);
+    }
+    sweep_slab  = sweep_slab->next;
+    sweep_index = 0;
+  }
+  return LL1LL_TRUE;
+}
+
+/* GCのサイクルの終了.
+ * 次のGCは, 生き残った量のGC_HEAP_GROWTH倍(最低GC_INITIAL_THRESHOLD)を旧世代に割り当てた後 */
+static void gc_finish(void)
+{
+  gc_state        = GC_IDLE;
+  allocated_bytes = 0;
+  gc_threshold    = live_bytes * GC_HEAP_GROWTH;
+  if (gc_threshold < GC_INITIAL_THRESHOLD) {
+    gc_threshold = GC_INITIAL_THRESHOLD;
+  }
+}
+
+/* GCのサイクルをworkの分だけ進める. マークとスイープのどちらを進めるかはgc_stateで決まる */
+static void gc_step(long work)
+{
+  if (gc_state == GC_MARKING) {
+    if (gc_mark_step(work)) {
+      gc_mark_finish();
+    }
+  } else if (gc_state == GC_SWEEPING) {
+    if (gc_sweep_step(work)) {
+      gc_finish();
+    }
+  }
+}
+
+/**** コンパクションを行うGC ****/
+/* 中身がsizeバイト以上(最低HEAP_COMPACT_CHUNK_SIZEバイト)のチャンクを確保し, チャンクの並びの先頭に置く */
+static CompactChunk *addCompactChunk(size_t size)
+{
+  CompactChunk *chunk;
+
+  if (size < HEAP_COMPACT_CHUNK_SIZE) {
+    size = HEAP_COMPACT_CHUNK_SIZE;
+  }
+  chunk       = (CompactChunk *)MEM_malloc(sizeof(CompactChunk) + size);
+  chunk->top  = (char *)chunk->data;
+  chunk->end  = chunk->top + size;
+  chunk->next = compact_chunks;
+  compact_chunks = chunk;
+  return chunk;
+}
+
+/* チャンクに, 中身がpayload_sizeバイトのオブジェクトを前詰めで割り当てる. ヘッダの直後に中身を置く.
+ * GCは安全点でしか行えないので, チャンクが足りなければ新しいチャンクを足す */
+static LL1LL_Object *allocCompact(LL1LL_ObjectType type, size_t payload_size)
+{
+  LL1LL_Object *new_entry;
+  size_t size = cellRound(sizeof(LL1LL_Object) + payload_size);
+
+  if (compact_chunks == NULL
+      || size > (size_t)(compact_chunks->end - compact_chunks->top)) {
+    addCompactChunk(size);
+  }
+  new_entry            = (LL1LL_Object *)compact_chunks->top;
+  compact_chunks->top += size;
+  allocated_bytes     += size;
+
+  new_entry->type = type;
+  setPayload(new_entry, new_entry + 1);
   return new_entry;
+}
+
+/* 値がオブジェクトなら, チャンクtoに詰めてコピーし, 値を転送先に書き換える.
+ * 元のオブジェクトには転送先を残すので, 共有されたオブジェクトも一度しかコピーしない.
+ * 配列の要素(ロープの左右)はgc_compactがtoを先頭から走査して書き換える */
+static void gc_compact_evacuate(LL1LL_Value *value, CompactChunk *to)
+{
+  LL1LL_Object *entry;
+  LL1LL_Object *new_entry;
+  size_t size;
+
+  if (get_type(*value) != LL1LL_OBJECT_TYPE) {
+    return;
+  }
+  entry = get_object(*value);
+  if (((char *)entry >= (char *)to->data && (char *)entry < to->end)
+      || isPermanent(entry)) {
+    /* コピー済みか, 永続領域のもの */
+    return;
+  }
+  if (entry->type == FORWARD_OBJECT) {
+    set_object(*value, entry->u.forward);
+    return;
+  }
+
+  size      = objectSize(entry);
+  new_entry = (LL1LL_Object *)to->top;
+  to->top  += cellRound(size);
+  memcpy(new_entry, entry, sizeof(LL1LL_Object));
+  setPayload(new_entry, new_entry + 1);
+  memcpy(payloadOf(new_entry), payloadOf(entry), size - sizeof(LL1LL_Object));
 
+  entry->type      = FORWARD_OBJECT;
+  entry->u.forward = new_entry;
+  set_object(*value, new_entry);
 }
 
-/* 配列オブジェクトの要素をマーク */
-static void array_mark(LL1LL_Object *ary_ptr)
+/* コンパクションを行うGC. 根(スタック)から辿れるオブジェクトを新しい1つのチャンクに
+ * 詰めてコピーし, 参照を全て転送先に書き換えて, 古いチャンクを解放する.
+ * コピーしたオブジェクトを先頭から走査して配列の要素を辿るので, マークスタックは要らない.
+ * 手間は生きているオブジェクトの量に比例し, 後の割り当ては新しいチャンクの残りから前詰めで行う */
+static void gc_compact(void)
 {
   int i;
-  LL1LL_Value ary_i;
-  ary_ptr->marked = LL1LL_TRUE; /* まず, 根本をマーク */
-
-  /* 配列要素のマーク */
-  for (i = 0; i < ary_ptr->u.ary.size; i++) {
-    ary_i = ary_ptr->u.ary.array_value[i];  /* 要素を取得 */
-    if (ary_i.type != LL1LL_OBJECT_TYPE) {
-      /* オブジェクト型でないなら次へ */
-      continue;
-    } else {
-      /* オブジェクト型の場合 */
-      if (ary_i.u.object->type == STRING_OBJECT) {
-        ary_i.u.object->marked = LL1LL_TRUE; /* 文字列ならそのままマーク */
-      } else {
-        /* should be ARRAY_OBJECT here */
-        array_mark(ary_i.u.object);            /* 配列のマーク */
-      }
+  int stack_top          = getStackTop();
+  LL1LL_Value *stack_p   = getStackPointer();
+  CompactChunk *from     = compact_chunks;
+  CompactChunk *to;
+  CompactChunk *next;
+  LL1LL_Object *entry;
+  LL1LL_Value *children;
+  int count;
+  char *scan;
+  size_t used = 0;
+
+  /* 生きているものは今使っている量を超えないので, それに割り当ての余裕を足した大きさを確保する */
+  for (to = from; to != NULL; to = to->next) {
+    used += to->top - (char *)to->data;
+  }
+  compact_chunks = NULL;
+  to = addCompactChunk(used + HEAP_COMPACT_CHUNK_SIZE);
+
+  /* 根から直接指されているオブジェクト */
+  for (i = 0; i < stack_top; i++) {
+    gc_compact_evacuate(&stack_p[i], to);
+  }
+
+  /* コピーしたオブジェクトを順に走査し, 配列の要素をコピーして書き換える(走査が追いつくまで) */
+  for (scan = (char *)to->data; scan < to->top; scan += cellRound(objectSize(entry))) {
+    entry    = (LL1LL_Object *)scan;
+    children = childrenOf(entry, &count);
+    for (i = 0; i < count; i++) {
+      gc_compact_evacuate(&children[i], to);
     }
   }
 
+  /* 重複を除く表の文字列を転送先に付け替えてから, 古いチャンクを解放する */
+  gc_intern_compact();
+
+  /* 古いチャンクには転送済みのものとごみしか残っていない */
+  for (; from != NULL; from = next) {
+    next = from->next;
+    MEM_free(from);
+  }
+
+  live_bytes = to->top - (char *)to->data;
+  gc_finish();
 }
 
-/* 配列の再帰的領域解放 : 要素から先にマークを確認し, 開放していく */
-static void array_sweep(LL1LL_Object *ary_ptr)
+/* 重複を除く表の文字列を, コピーされていれば転送先に付け替え, コピーされていなければ(死んでいるので)除く.
+ * 永続領域のものはそのまま */
+static void gc_intern_compact(void)
 {
   int i;
-  LL1LL_Value ary_i;
+  LL1LL_Object *entry;
 
-  /* 配列要素のスイープ */
-  for (i = 0; i < ary_ptr->u.ary.size; i++) {
-    ary_i = ary_ptr->u.ary.array_value[i];  /* 要素を取得 */
-    if (ary_i.type != LL1LL_OBJECT_TYPE) {
-      /* オブジェクト型でないなら次へ */
+  for (i = 0; i < intern_size; i++) {
+    entry = intern_table[i].object;
+    if (entry == NULL || entry == &intern_deleted || isPermanent(entry)) {
       continue;
+    }
+    if (entry->type == FORWARD_OBJECT) {
+      intern_table[i].object = entry->u.forward;
     } else {
-      /* オブジェクト型の場合 */
-      if (ary_i.u.object->marked == LL1LL_FALSE) {
-        /* マークがFALSE => スイープ（解放） */
-        if (ary_i.u.object->type == STRING_OBJECT) {
-          MEM_free(ary_i.u.object); /* 文字列ならばそのまま解放 */
-        } else {
-          /* should be ARRAY_OBJECT here */
-          /* 配列ならば要素のスイープ */
-          array_sweep(ary_i.u.object);
-        }
-      }
+      internRemove(i);
+    }
+  }
+}
+
+/* GC(ガベージコレクション)を最後まで行う. まずナーサリを空にし, 旧世代をマーク・アンド・スイープする.
+ * インクリメンタルGCの途中であれば, そのサイクルを終わらせる.
+ * コンパクションを行うモードでは, 生きているオブジェクトを詰めてコピーする */
+void startGC(void)
+{
+  if (gc_compacting == LL1LL_TRUE) {
+    gc_compact();
+    return;
+  }
+  gc_minor(); /* 新世代を旧世代に移す */
+#ifndef LL1LL_NO_GC_THREADS
+  if (gc_threads > 1) {
+    gc_parallel();
+    return;
+  }
+#endif /* LL1LL_NO_GC_THREADS */
+  if (gc_state == GC_IDLE) {
+    gc_mark_begin();
+  }
+  while (gc_state != GC_IDLE) {
+    gc_step(LONG_MAX);
+  }
+}
+
+/* インクリメンタルGCの有無と, 1回の安全点で行うGCの仕事量(辿る要素/セルの数)を設定する.
+ * 仕事量の上限がGCの停止時間の上限になる. 0以下ならGC_SLICE_WORKを使う */
+void setIncrementalGC(LL1LL_Boolean incremental, long slice_work)
+{
+  gc_incremental = incremental;
+  gc_slice_work  = (slice_work > 0) ? slice_work : GC_SLICE_WORK;
+  if (gc_incremental == LL1LL_FALSE && gc_state != GC_IDLE) {
+    startGC();
+  }
+}
+
+/* コンパクションを行うモードの有無を設定する. ヒープの作りが変わるので, 最初の割り当ての前に呼ぶこと.
+ * このモードでは世代別, インクリメンタル, 並列のGCは行わず, GCは全て世界を止めたコピーになる */
+void setCompactingGC(LL1LL_Boolean compacting)
+{
+  if (nursery_start != NULL || object_class.slabs != NULL || compact_chunks != NULL) {
+    fprintf(stderr, "setCompactingGC: heap is already in use\n");
+    exit(1);
+  }
+  gc_compacting = compacting;
+}
+
+/* GCの安全点で呼ばれる.
+ * 前回のGCからの旧世代への割り当て量が閾値を超えていればGCを始める.
+ * インクリメンタルGCでは, サイクルの途中であれば安全点ごとにgc_slice_workの分だけ進める.
+ * ナーサリの残りが少なければマイナーGCを行う.
+ * コンパクションを行うモードでは, 割り当て量が閾値を超えていればコピーを行う.
+ * 安全点では, 生きている値は全て実行時スタック(トップ未満)と記憶集合, 永続領域にある */
+void gcSafePoint(void)
+{
+  if (gc_compacting == LL1LL_TRUE) {
+    if (allocated_bytes >= gc_threshold) {
+      gc_compact();
+    }
+    return;
+  }
+
+  if (nursery_overflow == LL1LL_TRUE
+      || nursery_end - nursery_top < HEAP_NURSERY_SIZE / 4) {
+    gc_minor();
+  }
+
+  if (gc_state == GC_IDLE) {
+    if (allocated_bytes < gc_threshold) {
+      return;
+    }
+    if (gc_incremental == LL1LL_FALSE || gc_threads > 1) {
+      startGC();
+      return;
+    }
+    gc_mark_begin();
+  }
+
+  if (allocated_bytes >= gc_threshold * GC_HEAP_GROWTH) {
+    /* 割り当てにGCが追いつかなければ, 止めて最後まで行う */
+    startGC();
+  } else {
+    gc_step(gc_slice_work);
+  }
+}
+
+#ifndef LL1LL_NO_GC_THREADS
+/**** 並列GC ****/
+/* 実行スレッドとgc_threads-1個のワーカスレッドで, 止めた世界の中でマークとスイープを分担する.
+ * マークはスレッドごとのマークスタックを使い, 空になったら他のスレッドから盗む.
+ * スイープはスラブを単位に分け, 空きセルはスレッドごとのリストに集めて最後に繋ぐ */
+
+/* GCを行うスレッドごとの作業領域 */
+typedef struct {
+  int             id;           /* 番号. 0は実行スレッド */
+  pthread_t       thread;       /* ワーカスレッド */
+  pthread_mutex_t lock;         /* マークスタックの排他 */
+  LL1LL_Object    **mark_stack; /* マークスタック. 持ち主は末尾から, 盗む側は先頭から取る */
+  int             mark_head;    /* 盗まれていない先頭 */
+  int             mark_count;   /* 末尾 */
+  int             mark_alloc;   /* 割り当てサイズ */
+  size_t          live_bytes;   /* スイープで生き残った量 */
+  LL1LL_Object    *free_objects; /* スイープで空いたヘッダのリスト */
+  LL1LL_Object    *free_objects_tail; /* その末尾 */
+  HeapCell        *free_payloads[HEAP_NUM_PAYLOAD_CLASSES]; /* スイープで空いた中身のリスト */
+  HeapCell        *free_payloads_tail[HEAP_NUM_PAYLOAD_CLASSES]; /* その末尾 */
+  void            **large_payloads; /* スイープで空いた, MEM_mallocで確保した中身 */
+  int             large_count;
+  int             large_alloc;
+} GCWorker;
+
+static GCWorker *gc_workers = NULL;
+/* スレッドプール:実行スレッドがジョブを置き, ワーカを起こして終わるのを待つ */
+static pthread_mutex_t pool_lock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  pool_done  = PTHREAD_COND_INITIALIZER;
+static void (*pool_job)(GCWorker *worker) = NULL; /* 実行するジョブ. NULLならワーカを終了させる */
+static unsigned long pool_generation = 0;  /* ジョブを置くごとに増やす */
+static int pool_running = 0;               /* ジョブを実行中のワーカの数 */
+/* マークの終了判定:全スレッドが盗むものも無く待っていれば終わり */
+static pthread_mutex_t term_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  term_cond = PTHREAD_COND_INITIALIZER;
+static int mark_idle = 0;                  /* 待っているスレッドの数 */
+static LL1LL_Boolean mark_done = LL1LL_FALSE;
+/* スイープするスラブ. sweep_nextを原子的に進めて取り合う */
+static HeapSlab **sweep_slabs = NULL;
+static int sweep_slab_count = 0;
+static int sweep_slab_alloc = 0;
+static int sweep_next = 0;
 
+/* ワーカスレッドの本体. ジョブが置かれるのを待ち, 実行して終わりを知らせる */
+static void *gcWorkerMain(void *arg)
+{
+  GCWorker *worker = (GCWorker *)arg;
+  unsigned long seen = 0;
+  void (*job)(GCWorker *worker);
+
+  for (;;) {
+    pthread_mutex_lock(&pool_lock);
+    while (pool_generation == seen) {
+      pthread_cond_wait(&pool_start, &pool_lock);
+    }
+    seen = pool_generation;
+    job  = pool_job;
+    pthread_mutex_unlock(&pool_lock);
+
+    if (job == NULL) {
+      return NULL;
     }
+    job(worker);
+
+    pthread_mutex_lock(&pool_lock);
+    if (--pool_running == 0) {
+      pthread_cond_signal(&pool_done);
+    }
+    pthread_mutex_unlock(&pool_lock);
+  }
+}
+
+/* ジョブを全スレッド(実行スレッドを含む)で実行し, 全員が終わるまで待つ.
+ * jobがNULLならワーカを終了させる(終了は呼んだ側がpthread_joinで待つ) */
+static void runParallel(void (*job)(GCWorker *worker))
+{
+  pthread_mutex_lock(&pool_lock);
+  pool_job     = job;
+  pool_running = (job != NULL) ? gc_threads - 1 : 0;
+  pool_generation++;
+  pthread_cond_broadcast(&pool_start);
+  pthread_mutex_unlock(&pool_lock);
+
+  if (job == NULL) {
+    return;
+  }
+  job(&gc_workers[0]);
+
+  pthread_mutex_lock(&pool_lock);
+  while (pool_running > 0) {
+    pthread_cond_wait(&pool_done, &pool_lock);
+  }
+  pthread_mutex_unlock(&pool_lock);
+}
+
+/* ジョブの中でスレッドごとの作業領域を伸ばす.
+ * MEM_reallocはデバッグ時に共有のブロック一覧を繋ぎ変えるので, 複数のスレッドからは呼べない.
+ * ここで確保した領域はworkerFreeで解放する */
+static void *workerRealloc(void *ptr, size_t size)
+{
+  void *new_ptr;
+
+  new_ptr = realloc(ptr, size);
+  if (new_ptr == NULL) {
+    fprintf(stderr, "Failed to allocate GC work area. \n");
+    exit(1);
+  }
+  return new_ptr;
+}
+
+/* workerReallocで確保した領域の解放 */
+static void workerFree(void *ptr)
+{
+  free(ptr);
+}
+
+/* 自分のマークスタックに積む. 待っているスレッドがいれば起こす */
+static void parallelPush(GCWorker *worker, LL1LL_Object *entry)
+{
+  pthread_mutex_lock(&worker->lock);
+  if (worker->mark_head > 0 && worker->mark_head == worker->mark_count) {
+    worker->mark_head = worker->mark_count = 0;
   }
+  if (worker->mark_count >= worker->mark_alloc) {
+    worker->mark_alloc = (worker->mark_alloc == 0) ? 256 : worker->mark_alloc * 2;
+    worker->mark_stack = (LL1LL_Object **)workerRealloc(worker->mark_stack,
+                                                       sizeof(LL1LL_Object *) * worker->mark_alloc);
+  }
+  worker->mark_stack[worker->mark_count++] = entry;
+  pthread_mutex_unlock(&worker->lock);
 
-  /* 大本の配列のスイープ */
-  if (ary_ptr->marked == LL1LL_FALSE) {
-    MEM_free(ary_ptr);
+  if (__atomic_load_n(&mark_idle, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&term_lock);
+    pthread_cond_broadcast(&term_cond);
+    pthread_mutex_unlock(&term_lock);
   }
+}
 
+/* 自分のマークスタックの末尾から取る. 空ならNULL */
+static LL1LL_Object *parallelPop(GCWorker *worker)
+{
+  LL1LL_Object *entry = NULL;
+
+  pthread_mutex_lock(&worker->lock);
+  if (worker->mark_count > worker->mark_head) {
+    entry = worker->mark_stack[--worker->mark_count];
+  }
+  pthread_mutex_unlock(&worker->lock);
+  return entry;
 }
 
-/* GCのマークフェーズ */
-static void gc_mark(void)
+/* 他のスレッドのマークスタックの先頭から盗む. どこにも無ければNULL */
+static LL1LL_Object *parallelSteal(GCWorker *worker)
 {
+  LL1LL_Object *entry = NULL;
+  GCWorker *victim;
   int i;
-  /* スタックトップと, スタックを指すポインタを取得 */
-  int stack_top        = getStackTop();  
-  LL1LL_Value *stack_p = getStackPointer(); 
-  LL1LL_Object *pos;
 
-  /* 全マークをリセット */
-  for (pos = heap_head; pos != NULL; pos = pos->next)
-    pos->marked = LL1LL_FALSE;
+  for (i = 1; i < gc_threads && entry == NULL; i++) {
+    victim = &gc_workers[(worker->id + i) % gc_threads];
+    pthread_mutex_lock(&victim->lock);
+    if (victim->mark_count > victim->mark_head) {
+      entry = victim->mark_stack[victim->mark_head++];
+    }
+    pthread_mutex_unlock(&victim->lock);
+  }
+  return entry;
+}
+
+/* どこかのマークスタックに積まれているか */
+static LL1LL_Boolean parallelHasWork(void)
+{
+  LL1LL_Boolean found = LL1LL_FALSE;
+  int i;
 
-  /* スタック（参照できるオブジェクト）を走査 */
-  for (i = 0; i < stack_top; i++) {
-    if (stack_p[i].type != LL1LL_OBJECT_TYPE) { 
-      /* オブジェクトでないなら次へ */
+  for (i = 0; i < gc_threads && !found; i++) {
+    pthread_mutex_lock(&gc_workers[i].lock);
+    found = (gc_workers[i].mark_count > gc_workers[i].mark_head) ? LL1LL_TRUE : LL1LL_FALSE;
+    pthread_mutex_unlock(&gc_workers[i].lock);
+  }
+  return found;
+}
+
+/* 値がオブジェクトならマークし, 配列なら自分のマークスタックに積む.
+ * 同じオブジェクトを複数のスレッドが見つけても, マークを付け替えられたスレッドだけが積む */
+static void parallelValueMark(GCWorker *worker, LL1LL_Value value)
+{
+  LL1LL_Object *entry;
+  HeapSlab *slab;
+  int index;
+  uint64_t bit;
+
+  if (get_type(value) != LL1LL_OBJECT_TYPE) {
+    return;
+  }
+  entry = get_object(value);
+  if (isYoung(entry) || isPermanent(entry)) {
+    return;
+  }
+  slab  = slabOf(entry);
+  index = cellIndex(slab, entry);
+  bit   = (uint64_t)1 << (index % 64);
+  if (__atomic_load_n(&slab->mark_bits[index / 64], __ATOMIC_RELAXED) & bit
+      || __atomic_fetch_or(&slab->mark_bits[index / 64], bit, __ATOMIC_RELAXED) & bit) {
+    return;
+  }
+  if (hasChildren(entry)) {
+    parallelPush(worker, entry);
+  }
+}
+
+/* 並列マークのジョブ. スタックを分担して根とし, マークスタックも分け合ってから,
+ * 自分のマークスタックが空になったら他から盗み, 全員が空になるまで辿る */
+static void parallelMarkJob(GCWorker *worker)
+{
+  int i, from, to;
+  int stack_top          = getStackTop();
+  LL1LL_Value *stack_p   = getStackPointer();
+  LL1LL_Object *ary;
+  LL1LL_Value *children;
+  int count;
+
+  from = (int)((long)stack_top * worker->id / gc_threads);
+  to   = (int)((long)stack_top * (worker->id + 1) / gc_threads);
+  for (i = from; i < to; i++) {
+    parallelValueMark(worker, stack_p[i]);
+  }
+  /* インクリメンタルGCの途中のマークスタック(既にマーク済み. 辿りかけの配列は最初から辿り直す) */
+  for (i = worker->id; i < mark_stack_count; i += gc_threads) {
+    parallelPush(worker, mark_stack[i].object);
+  }
+
+  for (;;) {
+    ary = parallelPop(worker);
+    if (ary == NULL) {
+      ary = parallelSteal(worker);
+    }
+    if (ary != NULL) {
+      children = childrenOf(ary, &count);
+      for (i = 0; i < count; i++) {
+        parallelValueMark(worker, children[i]);
+      }
       continue;
-    } else {
-      /* マークを付ける */
-      if (is_string(stack_p[i])) {
-        stack_p[i].u.object->marked = LL1LL_TRUE;
-      } else {
-        /* should be ARRAY_OBJECT here */
-        array_mark(stack_p[i].u.object);  /* 配列マークのルーチンへ */
+    }
+
+    /* 盗むものも無い. 全員がこうなったら終わり, でなければ誰かが積むまで待つ */
+    pthread_mutex_lock(&term_lock);
+    __atomic_add_fetch(&mark_idle, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+      if (mark_done || mark_idle == gc_threads) {
+        mark_done = LL1LL_TRUE;
+        pthread_cond_broadcast(&term_cond);
+        pthread_mutex_unlock(&term_lock);
+        return;
       }
+      if (parallelHasWork()) {
+        break;
+      }
+      pthread_cond_wait(&term_cond, &term_lock);
+    }
+    __atomic_sub_fetch(&mark_idle, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&term_lock);
+  }
+}
+
+/* 並列スイープで空いたオブジェクトを, スレッドworkerのリストに集める */
+static void parallelRelease(LL1LL_Object *entry, void *arg)
+{
+  GCWorker *worker = (GCWorker *)arg;
+  void *payload;
+  size_t size;
+  SizeClass *size_class;
+  int class_i;
+
+  payload    = payloadOf(entry);
+  size       = payloadSize(entry);
+  size_class = payloadClass(size);
+  if (size_class == NULL) {
+    if (worker->large_count >= worker->large_alloc) {
+      worker->large_alloc = (worker->large_alloc == 0) ? 16 : worker->large_alloc * 2;
+      worker->large_payloads = (void **)workerRealloc(worker->large_payloads,
+                                                      sizeof(void *) * worker->large_alloc);
+    }
+    worker->large_payloads[worker->large_count++] = payload;
+  } else {
+    class_i = size_class - payload_class;
+    if (worker->free_payloads[class_i] == NULL) {
+      worker->free_payloads_tail[class_i] = (HeapCell *)payload;
     }
+    ((HeapCell *)payload)->next    = worker->free_payloads[class_i];
+    worker->free_payloads[class_i] = (HeapCell *)payload;
+  }
+  if (worker->free_objects == NULL) {
+    worker->free_objects_tail = entry;
   }
+  entry->type          = FREE_OBJECT;
+  entry->u.free_next   = worker->free_objects;
+  worker->free_objects = entry;
+}
+
+/* 並列スイープのジョブ. スラブを一枚ずつ取り, 空いたセルは自分のリストに集める */
+static void parallelSweepJob(GCWorker *worker)
+{
+  HeapSlab *slab;
+  int w, n;
 
+  while ((n = __atomic_fetch_add(&sweep_next, 1, __ATOMIC_RELAXED)) < sweep_slab_count) {
+    slab = sweep_slabs[n];
+    for (w = 0; w * 64 < slab->num_cells; w++) {
+      worker->live_bytes += sweepWord(slab, w, parallelRelease, worker);
+    }
+  }
 }
 
-/* GCのスイープフェーズ */
-static void gc_sweep(void)
+/* 並列GCでサイクルを最後まで進める. マイナーGCの後, 実行スレッドから呼ばれる */
+static void gc_parallel(void)
 {
-  LL1LL_Object *pos, *sweep_entry;
+  HeapSlab *slab;
+  GCWorker *worker;
+  int i, j;
 
-  /* ヒープ領域管理リストを走査し, マークが付いてない
-   * オブジェクトをリストから削除し, 開放していく */
-  for (pos = heap_head; pos != NULL; pos = pos->next) {
-    /* マークが付いてないオブジェクトを発見 */
-    if (pos->marked == LL1LL_FALSE) {
-      /* 削除・解放するエントリを設定 */
-      sweep_entry = pos; 
+  if (gc_state == GC_IDLE) {
+    /* 根はparallelMarkJobが分担して辿る */
+    clearMarks();
+    gc_state = GC_MARKING;
+  }
 
-      /* リストから削除 */
-      if (pos == heap_head) {
-        /* 先頭の場合は, 先頭を削除してから先頭を再設定 */
-        deleteHeapEntry(sweep_entry);
-        pos = heap_head;
-      } else {
-        /* 次のループに備えて一個前に戻る */ 
-        pos = pos->prev;
-        deleteHeapEntry(sweep_entry);
-      }
+  if (gc_state == GC_MARKING) {
+    mark_idle = 0;
+    mark_done = LL1LL_FALSE;
+    runParallel(parallelMarkJob);
+    mark_stack_count = 0;
+    gc_intern_sweep();
+    gc_state    = GC_SWEEPING;
+    sweep_slab  = object_class.slabs;
+    sweep_index = 0;
+    live_bytes  = 0;
+  }
 
-      /* 領域解放 */
-      if (sweep_entry->type == STRING_OBJECT) {
-        MEM_free(sweep_entry);
-      } else {
-        /* should be ARRAY_OBJECT here */
-        array_sweep(sweep_entry);
-      }
-    }  
+  /* インクリメンタルGCがスラブの途中までスイープしていれば, そのスラブは一人で済ませる */
+  if (sweep_slab != NULL && sweep_index > 0) {
+    gc_sweep_step(sweep_slab->num_cells - sweep_index * 64);
+  }
+
+  /* 残りのスラブを配列にして分け合う */
+  sweep_slab_count = 0;
+  for (slab = sweep_slab; slab != NULL; slab = slab->next) {
+    if (sweep_slab_count >= sweep_slab_alloc) {
+      sweep_slab_alloc = (sweep_slab_alloc == 0) ? 64 : sweep_slab_alloc * 2;
+      sweep_slabs = (HeapSlab **)MEM_realloc(sweep_slabs, sizeof(HeapSlab *) * sweep_slab_alloc);
+    }
+    sweep_slabs[sweep_slab_count++] = slab;
   }
+  sweep_next = 0;
+  runParallel(parallelSweepJob);
 
+  /* スレッドごとに集めた空きセルを空きリストに繋ぐ */
+  for (i = 0; i < gc_threads; i++) {
+    worker = &gc_workers[i];
+    if (worker->free_objects != NULL) {
+      worker->free_objects_tail->u.free_next = (LL1LL_Object *)object_class.free_list;
+      object_class.free_list = worker->free_objects;
+      worker->free_objects   = NULL;
+    }
+    for (j = 0; j < HEAP_NUM_PAYLOAD_CLASSES; j++) {
+      if (worker->free_payloads[j] != NULL) {
+        worker->free_payloads_tail[j]->next = (HeapCell *)payload_class[j].free_list;
+        payload_class[j].free_list = worker->free_payloads[j];
+        worker->free_payloads[j]   = NULL;
+      }
+    }
+    for (j = 0; j < worker->large_count; j++) {
+      MEM_free(worker->large_payloads[j]);
+    }
+    worker->large_count = 0;
+    live_bytes += worker->live_bytes;
+    worker->live_bytes = 0;
+  }
+  sweep_slab = NULL;
+  gc_finish();
 }
+#endif /* LL1LL_NO_GC_THREADS */
 
-/* GC(ガベージコレクション)を行う */
-void startGC(void)
+/* 並列GCのスレッドの数(実行スレッドを含む)を設定する. 1以下なら並列GCを行わない. GC_MAX_THREADSで打ち切る.
+ * 並列GCでは, GCは止めた世界の中で全てのスレッドで最後まで行う */
+void setParallelGC(int num_threads)
 {
-  gc_mark();  /* マーク */
-  gc_sweep(); /* スイープ */
+#ifndef LL1LL_NO_GC_THREADS
+  int i;
+
+  if (num_threads < 1) {
+    num_threads = 1;
+  }
+  if (num_threads > GC_MAX_THREADS) {
+    num_threads = GC_MAX_THREADS;
+  }
+  if (gc_state != GC_IDLE) {
+    startGC();  /* 途中のサイクルは今のスレッド数で終わらせる */
+  }
+
+  /* 今のワーカを終了させる */
+  if (gc_threads > 1) {
+    runParallel(NULL);
+    for (i = 1; i < gc_threads; i++) {
+      pthread_join(gc_workers[i].thread, NULL);
+    }
+  }
+  for (i = 0; i < gc_threads && gc_workers != NULL; i++) {
+    pthread_mutex_destroy(&gc_workers[i].lock);
+    workerFree(gc_workers[i].mark_stack);
+    workerFree(gc_workers[i].large_payloads);
+  }
+  MEM_free(gc_workers);
+  gc_workers = NULL;
+
+  gc_threads = num_threads;
+  if (gc_threads == 1) {
+    return;
+  }
+  gc_workers = (GCWorker *)MEM_malloc(sizeof(GCWorker) * gc_threads);
+  memset(gc_workers, 0, sizeof(GCWorker) * gc_threads);
+  for (i = 0; i < gc_threads; i++) {
+    gc_workers[i].id = i;
+    pthread_mutex_init(&gc_workers[i].lock, NULL);
+  }
+  for (i = 1; i < gc_threads; i++) {
+    if (pthread_create(&gc_workers[i].thread, NULL, gcWorkerMain, &gc_workers[i]) != 0) {
+      fprintf(stderr, "Failed to create a GC thread. \n");
+      exit(1);
+    }
+  }
+#else /* LL1LL_NO_GC_THREADS */
+  (void)num_threads;
+#endif /* LL1LL_NO_GC_THREADS */
 }
@@ -3,20 +3,87 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
+#ifndef LL1LL_NO_GC_THREADS
+#include <pthread.h>
+#endif /* LL1LL_NO_GC_THREADS */
 
 #include "MEM.h"
 #include "share.h"
 #include "table.h"
 #include "execute.h"
 
-/* 文字列srcのヒープ領域への割り当て. 文字列はヒープへとディープコピーされる */
-LL1LL_Object* alloc_string(char *src, LL1LL_Boolean is_literal);
-/* 文字列の連結を行い, 結果str1str2をヒープに登録する */
-LL1LL_Object* cat_string(char *src1, char *src2);
+#define GC_INITIAL_THRESHOLD (1024 * 1024) /* 最初のGCまでに割り当てる量(バイト) */
+#define GC_HEAP_GROWTH       (2)           /* GCの閾値は, 前回のGCで生き残った量のこの倍数 */
+#ifndef GC_INCREMENTAL
+#define GC_INCREMENTAL       (LL1LL_TRUE)  /* インクリメンタルGCを行うか(既定値) */
+#endif /* GC_INCREMENTAL */
+#ifndef GC_SLICE_WORK
+#define GC_SLICE_WORK        (4096)        /* インクリメンタルGCで1回の安全点に辿る要素/セルの数(既定値) */
+#endif /* GC_SLICE_WORK */
+#ifndef GC_COMPACTING
+#define GC_COMPACTING        (LL1LL_FALSE) /* コンパクションを行うGCにするか(既定値) */
+#endif /* GC_COMPACTING */
+#define GC_MAX_THREADS       (64)          /* 並列GCのスレッド数(実行スレッドを含む)の上限 */
+
+#define HEAP_SLAB_SIZE           (64 * 1024) /* スラブ(同じ大きさのセルを並べた領域)の大きさ(バイト). 2の冪 */
+#define HEAP_REGION_SLABS        (16)        /* 一度に確保するスラブの枚数 */
+#define HEAP_MIN_PAYLOAD         (16)        /* 中身のサイズクラスの最小のセル(バイト) */
+#define HEAP_NUM_PAYLOAD_CLASSES (5)         /* 中身のサイズクラスの数. 16から倍々で256バイトまで */
+
+#define HEAP_NURSERY_SIZE        (256 * 1024) /* ナーサリ(新世代)の大きさ(バイト) */
+#define HEAP_NURSERY_MAX_PAYLOAD (1024)       /* ナーサリに割り当てる中身の最大(バイト). 大きいものは旧世代へ */
+
+#define HEAP_COMPACT_CHUNK_SIZE  (1024 * 1024) /* コンパクションを行うモードで割り当てるチャンクの最小(バイト) */
+
+#define HEAP_INTERN_TABLE_SIZE   (1024)        /* 文字列の重複を除く表の最初の大きさ(2のべき) */
+#ifndef HEAP_INTERN_MAX_LENGTH
+#define HEAP_INTERN_MAX_LENGTH   (0)           /* 実行時に作った文字列は, この長さ以下なら重複を除く(既定値). 0なら除かない */
+#endif /* HEAP_INTERN_MAX_LENGTH */
+
+#define HEAP_ROPE_MIN_LENGTH     (256)         /* 連結結果がこの長さ以上ならロープにする */
+
+/* コンパイル時の文字列srcの永続領域への割り当て. 同じ内容の文字列は共有し, GCの対象にならない */
+LL1LL_Object* alloc_string(char *src);
+/* 文字列の連結を行い, 結果str1str2をヒープに登録する. len1, len2はそれぞれの長さ */
+LL1LL_Object* cat_string(char *str1, int len1, char *str2, int len2);
+/* 長さlengthの文字列の割り当て. 中身は呼んだ側で書き込む */
+LL1LL_Object* alloc_string_length(int length);
+/* 短い文字列なら, 同じ内容の文字列を一つにまとめた結果を返す */
+LL1LL_Object* internString(LL1LL_Object *str);
+/* 実行時に作った文字列の重複を除く長さの上限の設定. 0なら除かない(リテラルは常に除く) */
+void setInternStrings(int max_length);
+/* 文字列(かロープ)の連結. 長くなる連結はコピーせずにロープにする */
+LL1LL_Object* concatString(LL1LL_Object *str1, LL1LL_Object *str2);
+/* 文字列(かロープ)str1に, 長さlen2の文字列str2を連結する */
+LL1LL_Object* appendString(LL1LL_Object *str1, char *str2, int len2);
+/* 文字列(かロープ)の長さ */
+int stringLength(LL1LL_Object *str);
+/* 文字列(かロープ)の中身の連続した文字列. ロープは平坦化する */
+char *stringChars(LL1LL_Object *str);
+/* 文字列(かロープ)の中身をdestに書き写す(終端文字なし). ロープは平坦化しない */
+void copyStringChars(char *dest, LL1LL_Object *str);
+/* 文字列のハッシュ値(初めて求めた時に覚えておく) */
+unsigned int stringHash(LL1LL_Object *str);
+/* 二つの文字列が等しいか */
+LL1LL_Boolean equalString(LL1LL_Object *str1, LL1LL_Object *str2);
+/* 二つの文字列の辞書順の比較. strcmpと同じ符号を返す */
+int compareString(LL1LL_Object *str1, LL1LL_Object *str2);
 /* 配列のヒープ領域への割り当て. */
 LL1LL_Object* alloc_array(size_t size);
 
-/* gcを行う. マーク・アンド・スイープ方式 */
+/* 配列の要素に値を書き込んだ後に呼ぶ書き込みバリア */
+void gcWriteBarrier(LL1LL_Object *ary, LL1LL_Value value);
+
+/* gcを最後まで行う. 新世代はコピー, 旧世代はマーク・アンド・スイープ方式 */
 void startGC(void);
+/* インクリメンタルGCの有無と, 1回の安全点で行うGCの仕事量(停止時間の上限)の設定 */
+void setIncrementalGC(LL1LL_Boolean incremental, long slice_work);
+/* 並列GCのスレッドの数(実行スレッドを含む)の設定. 1なら並列GCを行わない */
+void setParallelGC(int num_threads);
+/* コンパクションを行うGC(生きているオブジェクトを詰めてコピーする)にするかの設定. 最初の割り当ての前に呼ぶ */
+void setCompactingGC(LL1LL_Boolean compacting);
+/* GCの安全点(関数呼び出し, 後方ジャンプ). 割り当て量が閾値を超えていればgcを行う */
+void gcSafePoint(void);
 
 #endif /* HEAP_H_INCLUDED */
@@ -1,14 +1,57 @@
 #include "compile.h"
 #include <stdio.h>
+#include <errno.h>
+
+/* 10進の整数strを*valueに読む. 整数として読めない, またはintに収まらなければ偽 */
+static LL1LL_Boolean parseInt(const char *str, int *value)
+{
+  char *end;
+  long n;
+
+  errno = 0;
+  n = strtol(str, &end, 10);
+  if (end == str || *end != '\0' || errno == ERANGE || n < INT_MIN || n > INT_MAX) {
+    return LL1LL_FALSE;
+  }
+  *value = (int)n;
+  return LL1LL_TRUE;
+}
 
 int main(int argc, char** argv)
 {
-  if (argc != 2) {
-    fprintf(stderr, "Usage: %s program \n", argv[0]);
+  int source_arg = 1;  /* ソースファイル名の引数の位置 */
+  int value;
+
+  /* -t スレッド数:並列GCのスレッド数(1以上. GC_MAX_THREADSで打ち切る)
+   * -c          :コンパクションを行うGC
+   * -i 長さ     :実行時に作ったこの長さ以下の文字列の重複を除く(0なら除かない) */
+  while (source_arg < argc && argv[source_arg][0] == '-') {
+    if (source_arg + 1 < argc && strcmp(argv[source_arg], "-t") == 0) {
+      if (!parseInt(argv[source_arg + 1], &value) || value < 1) {
+        break;  /* 使い方を表示する */
+      }
+      setParallelGC(value);
+      source_arg += 2;
+    } else if (source_arg + 1 < argc && strcmp(argv[source_arg], "-i") == 0) {
+      if (!parseInt(argv[source_arg + 1], &value) || value < 0) {
+        break;  /* 使い方を表示する */
+      }
+      setInternStrings(value);
+      source_arg += 2;
+    } else if (strcmp(argv[source_arg], "-c") == 0) {
+      setCompactingGC(LL1LL_TRUE);
+      source_arg += 1;
+    } else {
+      break;
+    }
+  }
+
+  if (argc != source_arg + 1) {
+    fprintf(stderr, "Usage: %s [-t gc_threads] [-c] [-i intern_length] program \n", argv[0]);
     return 1;
   }
 
-  if (openSource(argv[1])) {
+  if (openSource(argv[source_arg])) {
     compile();
     /* printCodeList(); */
     execute();
@@ -457,6 +457,110 @@ MEM_free_func(MEM_Controller controller,
   free(real_ptr);
 }
 
+/**** ストレージ(一括解放する領域)ルーチン ****/
+/* ページから前詰めで切り出していき, 解放はストレージごとにまとめて行う.
+ * 個々の領域の解放・再確保はできない */
+
+/* ストレージのデフォルトのページサイズ(Align数) */
+#define DEFAULT_PAGE_SIZE     (1024)
+
+/* ストレージのページ(単方向リスト) */
+typedef struct MemoryPage_tag MemoryPage;
+struct MemoryPage_tag {
+  int         cell_num;   /* ページのAlign数 */
+  int         use_count;  /* 使用済みのAlign数 */
+  MemoryPage  *next;      /* 次のページ */
+  Align       cell[1];    /* 領域本体(実際はcell_num個) */
+};
+
+/* ストレージ */
+struct MEM_Storage_tag {
+  MemoryPage  *page_list;         /* ページのリスト. 先頭が現在切り出し中のページ */
+  int         current_page_size;  /* 新しく作るページのAlign数 */
+};
+
+/* ストレージの生成 */
+MEM_Storage
+MEM_open_storage_func(MEM_Controller controller,
+                      char           *filename,
+                      int            line,
+                      int            page_size)
+{
+  MEM_Storage storage;
+
+  storage = MEM_malloc_func(controller, filename, line,
+                            sizeof(struct MEM_Storage_tag));
+  storage->page_list = NULL;
+  storage->current_page_size = (page_size > 0) ? page_size : DEFAULT_PAGE_SIZE;
+
+  return storage;
+}
+
+/* ストレージからsizeバイトの領域を切り出す.
+ * 先頭のページに空きが無ければ新しいページを先頭に足す */
+void*
+MEM_storage_malloc_func(MEM_Controller controller,
+                        char           *filename,
+                        int            line,
+                        MEM_Storage    storage,
+                        size_t         size)
+{
+  int         cell_num;
+  int         alloc_cell_num;
+  MemoryPage  *page;
+  void        *p;
+
+  cell_num = revalue_up_align(size);
+  page     = storage->page_list;
+
+  if (page != NULL
+      && page->use_count + cell_num <= page->cell_num) {
+    /* 現在のページに収まる */
+    p = &page->cell[page->use_count];
+    page->use_count += cell_num;
+  } else if (page != NULL
+             && cell_num > storage->current_page_size) {
+    /* ページより大きい要求は専用のページを作り, 先頭のページの後ろに繋ぐ.
+     * 先頭のページの残りは引き続き使う */
+    page = MEM_malloc_func(controller, filename, line,
+                           sizeof(MemoryPage) + ALIGN_SIZE * (cell_num - 1));
+    page->cell_num  = cell_num;
+    page->use_count = cell_num;
+    page->next      = storage->page_list->next;
+    storage->page_list->next = page;
+    p = &page->cell[0];
+  } else {
+    /* 新しいページを作って先頭に繋ぐ */
+    alloc_cell_num = (cell_num > storage->current_page_size)
+                     ? cell_num : storage->current_page_size;
+    page = MEM_malloc_func(controller, filename, line,
+                           sizeof(MemoryPage)
+                           + ALIGN_SIZE * (alloc_cell_num - 1));
+    page->cell_num  = alloc_cell_num;
+    page->use_count = cell_num;
+    page->next      = storage->page_list;
+    storage->page_list = page;
+    p = &page->cell[0];
+  }
+
+  return p;
+}
+
+/* ストレージのページを全て解放し, ストレージ自体も解放する */
+void
+MEM_dispose_storage_func(MEM_Controller controller,
+                         MEM_Storage    storage)
+{
+  MemoryPage *page;
+
+  while (storage->page_list) {
+    page = storage->page_list->next;
+    MEM_free_func(controller, storage->page_list);
+    storage->page_list = page;
+  }
+  MEM_free_func(controller, storage);
+}
+
 /* メモリコントローラにエラーハンドラの登録
  * MEM_Controller, MEM_ErrorHandlerは共にポインタのマクロであることに留意せよ */
 void
@@ -1,8 +1,18 @@
 #ifndef SHARE_H_INCLUDED
 #define SHARE_H_INCLUDED
 
-/* 各ブロックの最初のローカル変数のアドレス:0にはディスプレイが指すアドレス, 1には戻りアドレスが入る */
-#define FIRST_LOCAL_ADDRESS    (2) 
+#include <stdint.h>
+
+/* 値のNaNボクシング表現:LL1LL_Valueを8byteに詰める.
+ * ポインタを下位48bitに収める必要があるので64bit環境でのみ使う. LL1LL_NO_NAN_BOXINGで無効化 */
+#if !defined(LL1LL_NO_NAN_BOXING) && defined(UINTPTR_MAX) \
+    && (UINTPTR_MAX == 0xFFFFFFFFFFFFFFFFu)
+#define LL1LL_NAN_BOXING
+#endif /* LL1LL_NO_NAN_BOXING */
+
+/* 各ブロックの最初のローカル変数のアドレス:0にはディスプレイが指すアドレス, 1には戻りアドレス,
+ * 2には呼び出し側のフレーム先頭が入る */
+#define FIRST_LOCAL_ADDRESS    (3) 
 /* 一回のfgetsで取得する最大文字数 */
 #define MAX_LEN_SOURCE_LINE    (200)
 /* 識別子の最大長 */
@@ -13,21 +23,11 @@
 #define MAX_LEN_STRING_LITERAL (50)
 /* エラー時の文字列バッファの長さ */
 #define LINE_BUF_SIZE          (100)
-/* ブロックの最大深さ FIXME:こっちも動的確保できるように修正 */
+/* 関数の最大のネストの深さ(実行時のディスプレイの大きさ). 関数内のブロックのネストには制限は無い */
 #define MAX_BLOCK_LEVEL        (20)   
 /* コードの最大長 FIXME:長さは可変にしよう */
 #define MAX_CODE_SIZE          (2000)
 
-/* 文字列型を判定するマクロ */
-#define is_string(value) \
-  ((value.type == LL1LL_OBJECT_TYPE) && (value.u.object->type == STRING_OBJECT))
-/* 文字列のポインタを得る */
-#define get_string_value(value) \
-  (value.u.object->u.str.string_value)
-/* 配列型を判定するマクロ */
-#define is_array(value) \
-  ((value.type == LL1LL_OBJECT_TYPE) && (value.u.object->type == ARRAY_OBJECT))
-
 /* LL1LLの値の不完全型宣言(配列で参照される...) */
 typedef struct LL1LL_Value_tag *LL1LL_Value_ptr;
 
@@ -51,6 +51,9 @@ typedef enum {
 typedef enum {
   ARRAY_OBJECT,   /* 配列オブジェクト */
   STRING_OBJECT,  /* 文字列オブジェクト */
+  ROPE_OBJECT,    /* ロープ(連結を遅らせた文字列)オブジェクト */
+  FREE_OBJECT,    /* 空きセル(ヒープのスラブ内で, 割り当てられていないもの) */
+  FORWARD_OBJECT, /* 昇格済み(ナーサリ内で, 旧世代にコピーされたもの) */
   /* CLASS_OBJECT coming soon! */
 } LL1LL_ObjectType;
 
@@ -61,26 +64,106 @@ typedef struct {
   LL1LL_Value_ptr array_value;  /* 配列そのもの */
 } LL1LL_Array;
 
+/* LL1LLの文字列の本体:長さとハッシュ値を前に置いた文字列.
+ * 長さが分かっているので, 連結や比較, 出力で文字列を走査し直さなくてよい */
+typedef struct {
+  int          length;  /* 文字列の長さ(終端文字を含まない) */
+  unsigned int hash;    /* ハッシュ値. 必要になった時に求める. 0ならまだ求めていない */
+  char         chars[]; /* 文字列そのもの(終端文字付き) */
+} LL1LL_StringBody;
+
 /* LL1LLの文字列の構造体 */
 typedef struct {
-  LL1LL_Boolean is_literal;       /* リテラルか否か */
-  char          *string_value;    /* 文字列そのもの */
+  LL1LL_Boolean    is_literal;  /* リテラル(永続領域にあり, GCの対象外)か否か */
+  LL1LL_Boolean    is_interned; /* 重複を除く表に登録されているか. 登録されたもの同士は, 別のオブジェクトなら内容も違う */
+  LL1LL_StringBody *body;       /* 本体 */
 } LL1LL_String;
 
-/* LL1LLのオブジェクトの構造体:双方向リスト */
+/* LL1LLのロープの構造体. 長い文字列の連結は中身をコピーせず, 左右の文字列を指す節にしておく.
+ * 連続した文字列が必要になった時に平坦化する */
+typedef struct LL1LL_RopeBody_tag LL1LL_RopeBody;
+typedef struct {
+  LL1LL_RopeBody *body;  /* 本体 */
+} LL1LL_Rope;
+
+/* LL1LLのオブジェクトの構造体:ナーサリ(新世代)か, ヒープのスラブのセル(旧世代)に置かれる.
+ * コンパクションを行うモードでは, 中身と続けてヒープのチャンクに置かれる.
+ * GCのマーク等はスラブのビットマップに持つ */
 typedef struct LL1LL_Object_tag {
   LL1LL_ObjectType type;  /* オブジェクトの種類 */
-  unsigned int marked:1;  /* マークされたか(GC用) */
   union { /* 中身 */
     LL1LL_Array  ary;  
     LL1LL_String str;
+    LL1LL_Rope   rope;
+    struct LL1LL_Object_tag *free_next; /* 空きセルの場合:空きリストの次のセル */
+    struct LL1LL_Object_tag *forward;   /* 昇格/コピー済みの場合:コピー先 */
     /* LL1LL_Class class; comming soon! */
   } u;
-  struct LL1LL_Object_tag *prev; /* 前の要素 */
-  struct LL1LL_Object_tag *next; /* 次の要素 */
 } LL1LL_Object;
 
 /* LL1LLの値の構造体 */
+#ifdef LL1LL_NAN_BOXING
+/* NaNボクシング:doubleはそのままのbit列で持ち, それ以外の型は
+ * doubleでは現れない(符号付きの)NaNの領域に押し込む.
+ *   上位16bit < 0xFFF9 : double(NaNは0x7FF8...に正規化して格納)
+ *   上位16bit = 0xFFF9 + 型番号(LL1LL_TypeKind) : 下位48bitが値(int/論理値/ポインタ) */
+typedef struct LL1LL_Value_tag {
+  uint64_t bits;  /* 値のbit列 */
+} LL1LL_Value;
+
+#define LL1LL_NAN_TAG_SHIFT    (48)
+#define LL1LL_NAN_TAG_BASE     (0xFFF9u)                 /* 型番号0(int)のタグ */
+#define LL1LL_NAN_PAYLOAD_MASK (0x0000FFFFFFFFFFFFull)  /* 値の部分 */
+#define LL1LL_NAN_CANONICAL    (0x7FF8000000000000ull)  /* 正規化したNaN */
+/* 型kindのタグを付けたbit列 */
+#define LL1LL_NAN_TAG(kind) \
+  ((uint64_t)(LL1LL_NAN_TAG_BASE + (kind)) << LL1LL_NAN_TAG_SHIFT)
+
+/* doubleとbit列の相互変換. NaNはタグと衝突しないよう正規化する */
+static inline uint64_t ll1ll_box_double(double d)
+{
+  union { double d; uint64_t bits; } conv;
+  if (d != d) {
+    return LL1LL_NAN_CANONICAL;
+  }
+  conv.d = d;
+  return conv.bits;
+}
+static inline double ll1ll_unbox_double(uint64_t bits)
+{
+  union { double d; uint64_t bits; } conv;
+  conv.bits = bits;
+  return conv.d;
+}
+
+/* 型を得る */
+#define get_type(value) \
+  ((value).bits < LL1LL_NAN_TAG(0) \
+   ? LL1LL_DOUBLE_TYPE \
+   : (LL1LL_TypeKind)(((value).bits >> LL1LL_NAN_TAG_SHIFT) - LL1LL_NAN_TAG_BASE))
+/* 値を得る */
+#define get_int_value(value)     ((int)(int32_t)(uint32_t)(value).bits)
+#define get_double_value(value)  (ll1ll_unbox_double((value).bits))
+#define get_boolean_value(value) ((LL1LL_Boolean)((value).bits & 1u))
+#define get_object(value) \
+  ((LL1LL_Object *)(uintptr_t)((value).bits & LL1LL_NAN_PAYLOAD_MASK))
+#define get_stream_value(value) \
+  ((FILE *)(uintptr_t)((value).bits & LL1LL_NAN_PAYLOAD_MASK))
+/* 型と値を同時にセットする */
+#define set_int_value(value, i) \
+  ((value).bits = LL1LL_NAN_TAG(LL1LL_INT_TYPE) | (uint32_t)(int)(i))
+#define set_double_value(value, d) \
+  ((value).bits = ll1ll_box_double(d))
+#define set_boolean_value(value, b) \
+  ((value).bits = LL1LL_NAN_TAG(LL1LL_BOOLEAN_TYPE) | (uint64_t)(b))
+#define set_object(value, obj) \
+  ((value).bits = LL1LL_NAN_TAG(LL1LL_OBJECT_TYPE) | (uint64_t)(uintptr_t)(obj))
+#define set_stream_value(value, fp) \
+  ((value).bits = LL1LL_NAN_TAG(LL1LL_STREAM_TYPE) | (uint64_t)(uintptr_t)(fp))
+#define set_null(value) \
+  ((value).bits = LL1LL_NAN_TAG(LL1LL_NULL_TYPE))
+
+#else /* LL1LL_NAN_BOXING */
 typedef struct LL1LL_Value_tag {
   LL1LL_TypeKind type;  /* 型 */
   union {
@@ -92,6 +175,49 @@ typedef struct LL1LL_Value_tag {
   } u;
 } LL1LL_Value;
 
+/* 型を得る */
+#define get_type(value)          ((value).type)
+/* 値を得る */
+#define get_int_value(value)     ((value).u.int_value)
+#define get_double_value(value)  ((value).u.double_value)
+#define get_boolean_value(value) ((value).u.boolean_value)
+#define get_object(value)        ((value).u.object)
+#define get_stream_value(value)  ((value).u.stream_value)
+/* 型と値を同時にセットする */
+#define set_int_value(value, i) \
+  ((value).type = LL1LL_INT_TYPE, (value).u.int_value = (i))
+#define set_double_value(value, d) \
+  ((value).type = LL1LL_DOUBLE_TYPE, (value).u.double_value = (d))
+#define set_boolean_value(value, b) \
+  ((value).type = LL1LL_BOOLEAN_TYPE, (value).u.boolean_value = (b))
+#define set_object(value, obj) \
+  ((value).type = LL1LL_OBJECT_TYPE, (value).u.object = (obj))
+#define set_stream_value(value, fp) \
+  ((value).type = LL1LL_STREAM_TYPE, (value).u.stream_value = (fp))
+#define set_null(value) \
+  ((value).type = LL1LL_NULL_TYPE)
+#endif /* LL1LL_NAN_BOXING */
+
+/* ロープの本体 */
+struct LL1LL_RopeBody_tag {
+  int         length;    /* 連結結果の文字列の長さ */
+  LL1LL_Value parts[2];  /* 連結した左右の文字列(文字列かロープ).
+                          * 平坦化した後はparts[0]が結果の文字列で, parts[1]はnull */
+};
+
+/* 文字列型(ロープを含む)を判定するマクロ */
+#define is_string(value) \
+  ((get_type(value) == LL1LL_OBJECT_TYPE) \
+   && (get_object(value)->type == STRING_OBJECT || get_object(value)->type == ROPE_OBJECT))
+/* 文字列のポインタ, 長さを得る. ロープはポインタを得る時に平坦化する(heap.hのstringChars) */
+#define get_string_value(value) \
+  (stringChars(get_object(value)))
+#define get_string_length(value) \
+  (stringLength(get_object(value)))
+/* 配列型を判定するマクロ */
+#define is_array(value) \
+  ((get_type(value) == LL1LL_OBJECT_TYPE) && (get_object(value)->type == ARRAY_OBJECT))
+
 /* 入力ソース */
 extern FILE* input_source;
 
@@ -20,14 +20,34 @@ static int table_index = 0;   /* 現在参照している名前表のインデ
 static int table_func_index;  /* 現在参照している関数の名前表のインデックス */
 static int current_block_level = -1;  /* 現在のブロックレベル */
 
-/* TODO:ブロックの情報を構造体にまとめる */
-static int display[MAX_BLOCK_LEVEL];    /* 各ブロックの先頭スタック記憶域アドレス */
-static int last_index[MAX_BLOCK_LEVEL]; /* i番目の要素は, ブロックレベルiの最後の名前表のインデックス */
-static int last_addr[MAX_BLOCK_LEVEL];  /* i番目の要素は, ブロックレベルiの最後の変数のアドレス */
-static int block_kind[MAX_BLOCK_LEVEL]; /* i番目の要素は, ブロックレベルiの種類 */
-static int local_addr;        /* 現在のブロックの最後の変数番地 */
-static int break_label_count[MAX_BLOCK_LEVEL];    /* 各ブロックのbreakラベルの個数 */
-static int continue_label_count[MAX_BLOCK_LEVEL]; /* 各ブロックのcontinueラベルの個数 */
+/* ブロックの情報.
+ * 実行時にフレームを持つのは関数(トップレベル)のブロックだけで,
+ * その中のブロックの変数は囲む関数のフレーム内に割り当てる */
+typedef struct {
+  BlockKind kind;        /* ブロックの種類 */
+  int display;           /* ブロックの先頭アドレス. 囲む関数(トップレベル)のフレーム先頭からの相対 */
+  int frame_block;       /* 囲む関数(トップレベル)のブロックのレベル */
+  int frame_level;       /* 実行時のディスプレイのレベル(関数のネストの深さ) */
+  int frame_need;        /* 関数(トップレベル)のブロックのみ:中のブロックも含めたフレームの変数領域の大きさ */
+  int last_index;        /* 内側のブロックを開いた時の名前表のインデックス */
+  int last_addr;         /* 内側のブロックを開いた時の変数のアドレス */
+  int break_count;       /* breakラベルの個数 */
+  int continue_count;    /* continueラベルの個数 */
+} BlockInfo;
+
+static MEM_Storage table_storage = NULL; /* ブロックの情報を確保するコンパイル中の記憶域 */
+static BlockInfo *blocks = NULL;  /* ブロックの情報. ブロックレベルで引く */
+static int blocks_alloc  = 0;     /* blocksの割り当てサイズ */
+static int local_addr;            /* 現在のブロックの最後の変数番地 */
+
+/* ブロックの情報を確保する記憶域をセットする.
+ * 記憶域ごと解放されるので, それまでのブロックの情報は捨てる */
+void setTableStorage(MEM_Storage storage)
+{
+  table_storage = storage;
+  blocks        = NULL;
+  blocks_alloc  = 0;
+}
 
 /* 名前表エントリ数を増やし, 名前を登録 */
 void addTableName(char *identifier)
@@ -48,7 +68,7 @@ int addTableFunc(char *identifier, int address)
 {
   addTableName(identifier); /* 名前を登録 */
   name_table[table_index].kind                        = FUNC_IDENTIFIER;  /* 識別子の種類 */
-  name_table[table_index].u.f.rel_address.block_level = current_block_level;  /* ブロックレベル */
+  name_table[table_index].u.f.rel_address.block_level = blocks[current_block_level].frame_level;  /* 宣言したフレームのレベル */
   name_table[table_index].u.f.rel_address.address     = address;      /* 先頭番地をセット */
   name_table[table_index].u.f.num_parameter           = 0;            /* 仮引数の数は0で初期化 */
   table_func_index = table_index; /* 仮引数の情報登録のため, 現在の関数のインデックスを保存 */
@@ -61,7 +81,7 @@ int addTableParam(char *identifier)
 {
   addTableName(identifier); /* 名前を登録 */
   name_table[table_index].kind = PARAM_IDENTIFIER;  /* 識別子の種類 */
-  name_table[table_index].u.rel_address.block_level  = current_block_level; /* 現在のブロックレベル */
+  name_table[table_index].u.rel_address.block_level  = blocks[current_block_level].frame_level; /* 関数のフレームのレベル */
   name_table[table_func_index].u.f.num_parameter++; /* 現在の関数のインデックスを用いて, 仮引数の数を増やす */
   return table_index;
 }
@@ -69,10 +89,21 @@ int addTableParam(char *identifier)
 /* 名前表に変数を登録 */
 int addTableVar(char *identifier)
 {
+  BlockInfo *block = &blocks[current_block_level];
+  BlockInfo *frame = &blocks[block->frame_block];
+  int address;
+
   addTableName(identifier);
   name_table[table_index].kind = VAR_IDENTIFIER;
-  name_table[table_index].u.rel_address.block_level = current_block_level;  /* 現在のブロックレベル */
-  name_table[table_index].u.rel_address.address     = local_addr++; /* ローカル変数のアドレスを登録しつつ更新 */
+  /* 実行時のフレームは関数(トップレベル)単位なので, ブロック内の変数も
+   * 囲む関数のフレーム先頭からのアドレスにする.
+   * 兄弟のブロックは同じ先頭アドレスから割り当てるので, 領域を使い回す */
+  address = block->display + local_addr++;  /* ローカル変数のアドレスを登録しつつ更新 */
+  name_table[table_index].u.rel_address.block_level = block->frame_level; /* 関数のフレームのレベル */
+  name_table[table_index].u.rel_address.address     = address;
+  if (address + 1 > frame->frame_need) {
+    frame->frame_need = address + 1;
+  }
   return table_index;
 }
 
@@ -166,83 +197,95 @@ int getNumParams(int index)
  * スタック型記憶領域の更新, ブロックレベル更新 */
 void blockBegin(int first_address, BlockKind kind)
 {
-  int i;
-  /* トップレベルの際は, 初期設定を行う */
-  if (current_block_level == -1) {
-    local_addr    = first_address; /* (FIRST_LOCAL_ADDRESSが入る) */
-    table_index   = 0;             /* 名前表インデックスの初期化 */
-    block_kind[0] = TOPLEVEL;      /* ブロックの種類をトップレベルに */
-    display[0]    = 0;             /* トップレベルのディスプレイは0 */
-    /* ラベルの個数を全てリセット */
-    for (i = 0; i < MAX_BLOCK_LEVEL; i++) {
-      break_label_count[i] = 0;
-      continue_label_count[i] = 0;
+  BlockInfo *block, *new_blocks;
+
+  /* ブロックの情報の領域が足りなければ倍の領域に移し替える. ブロックのネストに上限は無い */
+  if (current_block_level + 1 >= blocks_alloc) {
+    blocks_alloc = (blocks_alloc == 0) ? 16 : blocks_alloc * 2;
+    new_blocks   = (BlockInfo *)MEM_storage_malloc(table_storage, sizeof(BlockInfo) * blocks_alloc);
+    if (current_block_level >= 0) {
+      memcpy(new_blocks, blocks, sizeof(BlockInfo) * (current_block_level + 1));
     }
-    current_block_level++;                 /* ブロックレベルを0に */
-    return;
+    blocks = new_blocks;
   }
+  block = &blocks[current_block_level+1];
 
-  /* ブロックを深くネストしすぎた場合は, エラー終了
-   * FIXME:ブロックネストも可変であるべき.
-   * <=> last_index, last_addrを可変に */
-  if (current_block_level == MAX_BLOCK_LEVEL-1) {
-    fprintf(stderr, "Too many nested blocks. \n");
-    exit(1);
+  if (current_block_level == -1) {
+    /* トップレベルの際は, 初期設定を行う */
+    table_index        = 0;        /* 名前表インデックスの初期化 */
+    block->display     = 0;        /* トップレベルのディスプレイは0 */
+    block->frame_block = 0;
+    block->frame_level = 0;
+  } else {
+    /* 現在のブロックの情報を保存 */
+    blocks[current_block_level].last_index = table_index;  /* 名前表インデックス */
+    blocks[current_block_level].last_addr  = local_addr;   /* ローカル変数のインデックス */
+    if (kind == FUNCTION_BLOCK) {
+      /* 関数ブロックは新しいフレームの先頭から始まる.
+       * 実行時のディスプレイのレベルになるので, 関数のネストだけは制限がある */
+      if (blocks[current_block_level].frame_level == MAX_BLOCK_LEVEL-1) {
+        fprintf(stderr, "Too many nested functions. \n");
+        exit(1);
+      }
+      block->display     = 0;
+      block->frame_block = current_block_level+1;
+      block->frame_level = blocks[current_block_level].frame_level + 1;
+    } else {
+      /* それ以外では, displayは前のアドレスを加算し, 囲む関数のフレームを引き継ぐ */
+      block->display     = blocks[current_block_level].display + local_addr;
+      block->frame_block = blocks[current_block_level].frame_block;
+      block->frame_level = blocks[current_block_level].frame_level;
+    }
   }
 
-  /* 現在のブロックの情報を保存 */
-  last_index[current_block_level] = table_index;  /* 名前表インデックス */
-  last_addr[current_block_level]  = local_addr;   /* ローカル変数のインデックス */
-  /* 関数ブロック以外では, displayは前のアドレスを加算 */
-  if (kind != FUNCTION_BLOCK) {
-    display[current_block_level+1] = display[current_block_level] + local_addr;
-  } 
-
-  /* 新しいブロックの最初の変数のアドレスに書き換え */
-  local_addr              = first_address;
+  /* 新しいブロックの最初の変数のアドレスに書き換え(トップレベルではFIRST_LOCAL_ADDRESSが入る) */
+  local_addr = first_address;
   /* ブロックレベルの更新 */
   current_block_level++;
-  block_kind[current_block_level] = kind;         /* ブロックの種類をセット */
+  block->kind       = kind;                       /* ブロックの種類をセット */
+  block->frame_need = first_address;              /* 変数が無くても, 復帰情報の分は必要 */
   /* ラベルの個数を初期化 */
-  break_label_count[current_block_level]    = 0;
-  continue_label_count[current_block_level] = 0;
+  block->break_count    = 0;
+  block->continue_count = 0;
 
 }
 
 /* ブロックの終わりで呼ばれる
- * 前のスタック型記憶領域を復帰する */
+ * 前のスタック型記憶域を復帰する */
 void blockEnd(void)
 {
   current_block_level--;  /* ブロックレベルを元に戻す */
 
   /* 名前表インデックスと, ローカル変数アドレス,
    * ブロックの種類の復帰 */
-  table_index = last_index[current_block_level];
-  local_addr  = last_addr[current_block_level];
+  if (current_block_level >= 0) {
+    table_index = blocks[current_block_level].last_index;
+    local_addr  = blocks[current_block_level].last_addr;
+  }
 }
 
 /* 現ブロックのbreakラベルの数を得る */
 int getBreakCount(void)
 {
-  return break_label_count[current_block_level];
+  return blocks[current_block_level].break_count;
 }
 
 /* 現ブロックのbreakラベルの数を増やして返す */
 int incBreakCount(void)
 {
-  return ++break_label_count[current_block_level];
+  return ++blocks[current_block_level].break_count;
 }
 
 /* 現ブロックのcontinueラベルの数を得る */
 int getContinueCount(void)
 {
-  return continue_label_count[current_block_level];
+  return blocks[current_block_level].continue_count;
 }
 
 /* 現ブロックのcontinueラベルの数を増やして返す */
 int incContinueCount(void)
 {
-  return ++continue_label_count[current_block_level];
+  return ++blocks[current_block_level].continue_count;
 }
 
 /* 現在のブロックレベルを得る
@@ -252,10 +295,16 @@ int getBlockLevel(void)
   return current_block_level;
 }
 
+/* 現在のブロックを囲む関数(トップレベル)の, 実行時のディスプレイのレベルを得る */
+int getFuncLevel(void)
+{
+  return blocks[current_block_level].frame_level;
+}
+
 /* 現在のブロックの種類を得る */
 BlockKind getBlockKind(void)
 {
-  return block_kind[current_block_level];
+  return blocks[current_block_level].kind;
 }
 
 /* 最後に登録した関数の仮引数の個数を返す */
@@ -264,20 +313,8 @@ int getCurrentNumParams(void)
   return name_table[table_func_index].u.f.num_parameter;
 }
 
-/* 現在のブロックが必要とするメモリ容量(ローカル変数+定数+仮引数の数) */
+/* 現在のブロックを囲むフレームが必要とするメモリ容量(復帰情報+中のブロックを含めたローカル変数) */
 int getBlockNeedMemory(void)
 {
-  return local_addr;
-}
-
-/* block_level番目のディスプレイにアドレス値をセット */
-void setDisplayAt(int block_level, int local_addr)
-{
-  display[block_level] = local_addr;
-}
-
-/* block_level番目のディスプレイの値を得る */
-int getDisplayAt(int block_level)
-{
-  return display[block_level];
+  return blocks[blocks[current_block_level].frame_block].frame_need;
 }
@@ -35,6 +35,8 @@ typedef struct {
 
 /* 公開モジュール群 */
 
+void setTableStorage(MEM_Storage storage);  /* ブロックの情報を確保する記憶域をセット */
+
 /* 名前表に名前を登録. 名前表追加系関数では必ず呼ばれ, 名前表エントリ数の増加も暗黙で行う */
 void addTableName(char *identifier);  
 /* 名前表登録ルーチン. 返り値は現在のエントリ数 */
@@ -60,14 +62,13 @@ int getNumParams(int table_index);            /* 関数の仮引数の数を得
 void blockBegin(int first_address, BlockKind kind); /* ブロックの開始で呼ばれ, スタック型記憶領域を更新する */
 void blockEnd(void);                /* ブロックの終了で呼ばれ, 前のスタック型記憶域を復帰する */
 int getBlockLevel(void);            /* 現ブロックのレベルを得る */
+int getFuncLevel(void);             /* 現ブロックを囲む関数(トップレベル)のレベルを得る */
 BlockKind getBlockKind(void);       /* 現ブロックの種類を得る */
 int getCurrentNumParams(void);      /* 最後に登録した関数のパラメタ数を得る */
-int getBlockNeedMemory(void);       /* 現在のブロックが必要とするメモリ容量 */
+int getBlockNeedMemory(void);       /* 現ブロックを囲むフレームが必要とするメモリ容量 */
 int getBreakCount(void);            /* 現ブロックのbreakラベルの数を返す */
 int incBreakCount(void);            /* 現ブロックのcontinueラベルの数を増やして返す */
 int getContinueCount(void);         /* 現ブロックのcontinueラベルの数を返す */
 int incContinueCount(void);         /* 現ブロックのbreakラベルの数を増やして返す */
-int getDisplayAt(int block_level); /* block_levelにおけるディスプレイの値を得る */  
-void setDisplayAt(int block_level, int address); /* block_levelにおけるディスプレイの値をaddressにセット */
 
 #endif /* TABLE_H_INCLUDED */